@@ -0,0 +1,247 @@
+/*
+ benchmarks of the hot paths: sweeps, Newton-Raphson, data export and
+ PlotScript command throughput. results go to a JSON file, see
+ bench/compare.py for checking them against bench/baseline.json.
+
+   calc_bench [--quick] [--repeat=N] [--filter=substring] [--out=file.json]
+
+ --quick divides the problem sizes by ten. every case is run --repeat times
+ (default 3) and the fastest run is reported.
+*/
+#include <csignal>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+
+#include "calculation.hpp"
+#include "newton_raphson.hpp"
+
+struct BenchCase {
+  std::string name;
+  size_t items; // points, solves, rows or commands per run
+  std::function<void()> run;
+};
+
+struct BenchResult {
+  std::string name;
+  size_t items;
+  double best;
+  double mean;
+};
+
+double scale = 1.;
+size_t scaled(double n) { return (size_t) (n*scale) < 1 ? 1 : (size_t) (n*scale); }
+
+Variable x("x",""), y("y",""), z("z","");
+
+RowResult cheap_1d() { return {x.real(), x.real()*x.real()}; }
+RowResult cheap_2d() { return {x.real(), y.real(), x.real()*y.real()}; }
+RowResult cheap_3d_point(const SweepPoint& p) { return {p[0].real(), p[1].real(), p[2].real(), p[0].real()*p[1].real()*p[2].real()}; }
+RowResult cheap_3d() { return {x.real(), y.real(), z.real(), x.real()*y.real()*z.real()}; }
+
+// a few hundred transcendental calls per point, like a dispersion relation
+RowResult expensive_2d(const SweepPoint& p) {
+  cd s = 0., w = p[0] + cd(0., 1.)*p[1];
+  for (int k = 1; k <= 100; k++) s += std::exp(-w*(double) k)/(w + (double) k);
+  return {p[0].real(), p[1].real(), std::abs(s)};
+}
+
+void cheap_batch(const SweepBatch& b, BatchOutput& out) {
+  for (size_t i = 0; i < b.size; i++) {
+    out.columns[0][i] = b.re[0][i];
+    out.columns[1][i] = b.re[1][i];
+    out.columns[2][i] = b.re[0][i]*b.re[1][i];
+  }
+}
+
+// the same kernel writing its complex sum as one typed column
+void expensive_2d_typed(const SweepPoint& p, ResultRow& row) {
+  cd s = 0., w = p[0] + cd(0., 1.)*p[1];
+  for (int k = 1; k <= 100; k++) s += std::exp(-w*(double) k)/(w + (double) k);
+  row << p[0] << p[1] << s;
+}
+
+cd cubic(cd w) { return w*w*w - 1.; }
+cd transcendental(cd w) { return std::exp(w) - 3.*w + std::sin(w); }
+
+std::vector<cd> guesses(size_t n) {
+  std::vector<cd> g(n);
+  for (size_t i = 0; i < n; i++) g[i] = std::polar(0.5 + 1.5*i/n, 0.1 + 17.*i/n);
+  return g;
+}
+
+void sweep(std::string name, VariableList variables, RowResult (*f)(), std::vector<std::string> headers) {
+  Calculation c(name);
+  c.headers = headers;
+  c.work(variables, f);
+}
+
+std::vector<BenchCase> cases() {
+  std::vector<BenchCase> list;
+  size_t n1 = scaled(2e6), n2 = (size_t) std::sqrt((double) scaled(1e6)), n3 = (size_t) std::cbrt((double) scaled(1e6));
+  list.push_back({"sweep_1d_cheap", n1, [n1]() {
+    x.points = linspace(0, 1, n1);
+    sweep("bench_1d", {&x}, cheap_1d, {"x","f"});
+  }});
+  list.push_back({"sweep_2d_cheap", n2*n2, [n2]() {
+    x.points = linspace(0, 1, n2); y.points = linspace(0, 1, n2);
+    sweep("bench_2d", {&x,&y}, cheap_2d, {"x","y","f"});
+  }});
+  list.push_back({"sweep_3d_cheap", n3*n3*n3, [n3]() {
+    x.points = linspace(0, 1, n3); y.points = linspace(0, 1, n3); z.points = linspace(0, 1, n3);
+    sweep("bench_3d", {&x,&y,&z}, cheap_3d, {"x","y","z","f"});
+  }});
+  size_t ns = scaled(1e6);
+  list.push_back({"sweep_3d_sobol", ns, [ns]() {
+    x.points = linspace(0, 1, 100); y.points = linspace(0, 1, 100); z.points = logspace(1, 100, 100);
+    Calculation c("bench_3d_sobol");
+    c.headers = {"x","y","z","f"};
+    c.work_sampled({&x,&y,&z}, (SweepFunction) cheap_3d_point, Sampler::SOBOL, ns);
+  }});
+  size_t ne = (size_t) std::sqrt((double) scaled(1e5));
+  list.push_back({"sweep_2d_expensive", ne*ne, [ne]() {
+    x.points = linspace(0.1, 2, ne); y.points = linspace(-1, 1, ne);
+    Calculation c("bench_2d_expensive");
+    c.headers = {"x","y","f"};
+    c.work({&x,&y}, (SweepFunction) expensive_2d);
+  }});
+  list.push_back({"sweep_2d_complex", ne*ne, [ne]() {
+    x.points = linspace(0.1, 2, ne); y.points = linspace(-1, 1, ne);
+    Calculation c("bench_2d_complex");
+    c.schema.real("x").real("y").complex("f");
+    c.work({&x,&y}, expensive_2d_typed);
+  }});
+  list.push_back({"sweep_2d_batched", n2*n2, [n2]() {
+    x.points = linspace(0, 1, n2); y.points = linspace(0, 1, n2);
+    Calculation c("bench_2d_batched");
+    c.headers = {"x","y","f"};
+    c.work({&x,&y}, (BatchFunction) cheap_batch);
+  }});
+
+  size_t nr = scaled(2e5);
+  list.push_back({"nr_polynomial", nr, [nr]() {
+    NewtonRaphson solver;
+    std::vector<cd> g = guesses(nr);
+    for (size_t i = 0; i < nr; i++) solver.solve(cubic, g[i], 1e-12, 1e-12);
+  }});
+  list.push_back({"nr_transcendental", nr, [nr]() {
+    NewtonRaphson solver;
+    std::vector<cd> g = guesses(nr);
+    for (size_t i = 0; i < nr; i++) solver.solve(transcendental, g[i], 1e-12, 1e-12);
+  }});
+  list.push_back({"nr_batch_polynomial", nr, [nr]() {
+    NewtonRaphson solver;
+    NewtonRaphson::batch_result out;
+    std::vector<cd> g = guesses(nr);
+    solver.solve_batch(cubic, g.data(), nr, 1e-12, 1e-12, out);
+  }});
+
+  size_t rows = scaled(1e7);
+  list.push_back({"export_text", rows, [rows]() {
+    std::string path = Calculation::calc_path+"bench_export.data";
+    TextDataSink sink(path, {"x","y","f"});
+    double row[3];
+    for (size_t i = 0; i < rows; i++) {
+      row[0] = i*1e-7; row[1] = 1. - row[0]; row[2] = row[0]*row[1];
+      sink.write_row(row, 3);
+    }
+    sink.close();
+    std::remove(path.c_str());
+  }});
+  list.push_back({"export_binary", rows, [rows]() {
+    std::string path = Calculation::calc_path+"bench_export.bin";
+    BinaryDataWriter sink(path, {"x","y","f"}, std::vector<size_t>(1, rows));
+    double row[3];
+    for (size_t i = 0; i < rows; i++) {
+      row[0] = i*1e-7; row[1] = 1. - row[0]; row[2] = row[0]*row[1];
+      sink.write_row(row, 3);
+    }
+    sink.close();
+    std::remove(path.c_str());
+  }});
+
+  // the gnuplot side is 'cat > /dev/null', so this measures script building
+  // and the pipe, not rendering
+  size_t scripts = scaled(200), commands = 500;
+  list.push_back({"plot_commands", scripts*commands, [scripts, commands]() {
+    for (size_t s = 0; s < scripts; s++) {
+      PlotScript ps("bench", "png");
+      ps.set_output("bench");
+      for (size_t k = 0; k < commands; k++)
+        ps.r("set label "+std::to_string(k+1)+" at "+std::to_string(k)+",0 'label' "+ps.next_style("point"));
+    }
+  }});
+  return list;
+}
+
+std::string json_escape(const std::string& s) {
+  std::string out;
+  for (size_t i = 0; i < s.size(); i++) {
+    if (s[i] == '"' || s[i] == '\\') out += '\\';
+    out += s[i];
+  }
+  return out;
+}
+
+void write_json(const std::string& path, const std::vector<BenchResult>& results, int repeat) {
+  std::ofstream out(path);
+  out << "{\n  \"suite\": \"calc_bench\",\n";
+  out << "  \"scale\": " << scale << ",\n";
+  out << "  \"repeat\": " << repeat << ",\n";
+  out << "  \"hardware_threads\": " << ThreadPool::hardware_threads() << ",\n";
+  out << "  \"cases\": [\n";
+  for (size_t i = 0; i < results.size(); i++) {
+    const BenchResult& r = results[i];
+    char line[512];
+    snprintf(line, sizeof(line),
+      "    {\"name\": \"%s\", \"items\": %zu, \"seconds\": %.6f, \"mean_seconds\": %.6f, \"items_per_second\": %.1f}%s\n",
+      json_escape(r.name).c_str(), r.items, r.best, r.mean, r.items/r.best, (i+1 < results.size()) ? "," : "");
+    out << line;
+  }
+  out << "  ]\n}\n";
+}
+
+int main(int argc, char* argv[]) {
+  signal(SIGPIPE, SIG_IGN);
+  int repeat = 3;
+  std::string filter = "", out_path = "bench_results.json";
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--quick") scale = 0.1;
+    else if (arg.rfind("--repeat=", 0) == 0) repeat = std::stoi(arg.substr(9));
+    else if (arg.rfind("--filter=", 0) == 0) filter = arg.substr(9);
+    else if (arg.rfind("--out=", 0) == 0) out_path = arg.substr(6);
+    else { std::cout << "unknown argument: " << arg << std::endl; return 1; }
+  }
+  if (repeat < 1) repeat = 1;
+
+  Calculation::calc_path = "bench_output/";
+  Calculation::threads = 0;
+  PlotScript::silent = true;
+  PlotScript::pooled = true;
+  GnuplotPool::command = "cat > /dev/null";
+  calc_util::mkdir(Calculation::calc_path);
+
+  std::vector<BenchResult> results;
+  std::vector<BenchCase> list = cases();
+  for (size_t c = 0; c < list.size(); c++) {
+    if (list[c].name.find(filter) == std::string::npos) continue;
+    BenchResult r = { list[c].name, list[c].items, 0., 0. };
+    for (int k = 0; k < repeat; k++) {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      list[c].run();
+      double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+      if (k == 0 || seconds < r.best) r.best = seconds;
+      r.mean += seconds/repeat;
+    }
+    results.push_back(r);
+  }
+  write_json(out_path, results, repeat);
+
+  printf("\n%-22s %12s %12s %14s\n", "case", "items", "seconds", "items/s");
+  for (size_t i = 0; i < results.size(); i++)
+    printf("%-22s %12zu %12.4f %14.4g\n", results[i].name.c_str(), results[i].items, results[i].best, results[i].items/results[i].best);
+  printf("results written to %s\n", out_path.c_str());
+  return 0;
+}
@@ -0,0 +1,58 @@
+#!/usr/bin/env python3
+"""
+compares two calc_bench result files case by case and exits with status 1
+if any case got slower than the threshold allows.
+
+  bench/compare.py bench/baseline.json bench_results.json [--threshold 0.15]
+"""
+import argparse
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        results = json.load(f)
+    return results, {case["name"]: case for case in results["cases"]}
+
+
+def main():
+    parser = argparse.ArgumentParser(description="flag calc_bench regressions against a baseline")
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--threshold", type=float, default=0.15,
+                        help="allowed relative slowdown per case (default 0.15)")
+    args = parser.parse_args()
+
+    baseline, base_cases = load(args.baseline)
+    current, cur_cases = load(args.current)
+    if baseline.get("scale") != current.get("scale"):
+        print("warning: results were taken at different scales (%s vs %s)"
+              % (baseline.get("scale"), current.get("scale")))
+
+    regressions = 0
+    print("%-22s %14s %14s %9s" % ("case", "baseline/s", "current/s", "change"))
+    for name, case in cur_cases.items():
+        base = base_cases.get(name)
+        if base is None:
+            print("%-22s %14s %14.4g %9s" % (name, "-", case["items_per_second"], "new"))
+            continue
+        change = case["items_per_second"]/base["items_per_second"] - 1.
+        flag = ""
+        if change < -args.threshold:
+            flag = "  REGRESSION"
+            regressions += 1
+        print("%-22s %14.4g %14.4g %+8.1f%%%s"
+              % (name, base["items_per_second"], case["items_per_second"], 100.*change, flag))
+    for name in base_cases:
+        if name not in cur_cases:
+            print("%-22s missing from current results" % name)
+
+    if regressions:
+        print("%d case(s) slower than the baseline by more than %.0f%%" % (regressions, 100.*args.threshold))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -5,6 +5,10 @@
 #include <cstdlib>
 #include <vector>
 #include <iostream>
+#include <cstdint>
+#include <atomic>
+
+#include "philox.hpp"
 
 namespace calc_util
 {
@@ -20,8 +24,46 @@ namespace calc_util
         return results;
     }
 
-    float random() {
-        return (float)rand() / (float) RAND_MAX;
+    /*
+     random() draws from Philox stream 'stream' of the key set by
+     seed_random(), which takes the part srand() had when random() was built
+     on rand(). a thread selects its stream with random_stream(); the sweeps
+     of Calculation select the flat grid index (the sample index of a
+     sampled sweep, the first index of a batch) before every call of the
+     iteration function, so what it draws depends on the seed and the point
+     only, not on threads, scheduling or shards. a thread that never selects
+     a stream draws stream 0.
+    */
+    std::atomic<uint64_t> random_seed(0);
+    std::atomic<uint64_t> random_generation(0); // counts seed_random() calls
+
+    // per thread: the selected stream, and the seed generation its draws
+    // were started from (none after random_stream())
+    thread_local uint64_t selected_stream = 0;
+    thread_local uint64_t started_generation = ~0ULL;
+
+    // restarts the calling thread's draws at the start of stream 'stream';
+    // the stream is set up by the next draw, so sweeps select one per point
+    // at the cost of two stores
+    void random_stream(uint64_t stream) {
+        selected_stream = stream;
+        started_generation = ~0ULL;
+    }
+
+    // every thread restarts its stream from the new seed at its next draw
+    void seed_random(uint64_t seed) {
+        random_seed = seed;
+        random_generation++;
+    }
+
+    // uniform in [0,1)
+    double random() {
+        thread_local PhiloxStream draws(0, 0);
+        if (started_generation != random_generation) {
+            started_generation = random_generation;
+            draws = PhiloxStream(random_seed, selected_stream);
+        }
+        return draws.uniform();
     }
 
 
@@ -33,6 +75,16 @@ namespace calc_util
       }
     }
 
+    // FNV-1a, chainable through the seed
+    uint64_t hash_bytes(const void* bytes, size_t n, uint64_t seed = 14695981039346656037ULL) {
+      const unsigned char* b = (const unsigned char*) bytes;
+      for (size_t i = 0; i < n; i++) {
+        seed ^= b[i];
+        seed *= 1099511628211ULL;
+      }
+      return seed;
+    }
+
     void mkdir(std::string dirpath) {
       if (-1 == std::system(("mkdir -p "+dirpath).c_str()) ) {
         std::cout << "some error making dir: " << dirpath << std::endl;
@@ -1,17 +1,36 @@
 #ifndef CALCULATION_H
 #define CALCULATION_H
 
-#define EXPORT_DELIMITER " "
-
 #include <string>
 #include <vector>
 #include <fstream>
 #include <iostream>
 #include <iomanip>
 #include <complex>
+#include <queue>
+#include <map>
+#include <algorithm>
+#include <memory>
+#include <array>
+#include <tuple>
+#include <future>
+#include <mutex>
+#include <climits>
 
 #include "plot_script.hpp"
 #include "calc_util.hpp"
+#include "thread_pool.hpp"
+#include "data_file.hpp"
+#include "result_cache.hpp"
+#include "simd_complex.hpp"
+#include "grid.hpp"
+#include "plot_queue.hpp"
+#include "decimate.hpp"
+#include "sweep_stats.hpp"
+#include "result_table.hpp"
+#include "result_schema.hpp"
+#include "shard.hpp"
+#include "sampling.hpp"
 
 typedef std::complex<double> cd;
 
@@ -49,7 +68,10 @@ typedef std::vector<Parameter*> ParameterList;
 
 class Variable: public Parameter {
 public:
+  // explicit points take precedence over a lazy grid
   std::vector<cd> points;
+  std::shared_ptr<const Grid> grid;
+
   Variable(std::string name_label, std::string units_label)
     : Parameter(0, name_label, units_label)
     {
@@ -68,7 +90,23 @@ public:
 
 
   std::string stringify(bool include_name = true, bool include_units = true) {
-    return Parameter::stringify(include_name, include_units) + " ["+to_string(points.front())+"->"+to_string(points.back())+"]";
+    return Parameter::stringify(include_name, include_units) + " ["+to_string(point(0))+"->"+to_string(point(num_points()-1))+"]";
+  }
+
+  template <typename G>
+  void set_grid(const G& g) {
+    grid = std::make_shared<G>(g);
+    points.clear();
+  }
+
+  size_t num_points() const {
+    if (points.empty() && grid) return grid->size();
+    return points.size();
+  }
+
+  cd point(size_t i) const {
+    if (points.empty() && grid) return grid->at(i);
+    return points[i];
   }
 
 };
@@ -76,17 +114,95 @@ typedef std::vector<Variable*> VariableList;
 typedef std::vector<double> RowResult;
 typedef std::vector<std::string> PlotCommands;
 
+// one grid point handed to a context-taking iteration function. every worker
+// thread owns its own SweepPoint, so the shared Variable objects are not touched.
+struct SweepPoint {
+  size_t index; // flat index into the variable grid, last variable fastest
+  std::vector<size_t> coords; // point index along each variable
+  std::vector<cd> values; // one value per variable, in VariableList order
+  const VariableList* variables;
+
+  cd operator[](int i) const { return values[i]; }
+  cd at(int i) const { return values.at(i); }
+
+  cd value(const Variable& v) const {
+    for (int i = 0; i < variables->size(); i++)
+      if (variables->at(i) == &v) return values.at(i);
+    std::cout << "sweep point: variable not in sweep: " << v.name_label << std::endl;
+    return cd(0.,0.);
+  }
+};
+typedef RowResult (*SweepFunction)(const SweepPoint&);
+
+// notified by the serial sweep of work(VariableList, iteration_func) as it
+// walks the grid; a line is one pass over the innermost variable's points,
+// or the part of it a shard computes. in a sampled sweep every sample is a
+// line of its own. skipped() follows a point whose row came from the cache,
+// so the iteration function was not called for it. the other sweeps do not
+// notify listeners and log that they ignore them.
+class SweepListener {
+public:
+  virtual ~SweepListener() { }
+  virtual void begin_sweep() { }
+  virtual void begin_line() { }
+  virtual void skipped() { }
+};
+
+// structure-of-arrays block of consecutive grid points for batched iteration
+// functions. every array is 64 byte aligned and padded to 'padded' entries (a
+// multiple of CALC_SIMD_WIDTH) with zeros, so kernels can run on whole packs.
+struct SweepBatch {
+  size_t first_index; // flat index of point 0, the rest follow one apart (N in a strided shard)
+  size_t size;
+  size_t padded;
+  std::vector<const double*> re; // re[v][i]: real part of variable v at point i
+  std::vector<const double*> im;
+};
+
+// preallocated output block: columns[j][i] is header j of point i
+struct BatchOutput {
+  size_t size;
+  size_t padded;
+  std::vector<double*> columns;
+};
+typedef void (*BatchFunction)(const SweepBatch&, BatchOutput&);
+
+// writes the row of one point into the slot it is handed, one value per
+// header, so no row is allocated
+typedef void (*SlotFunction)(const SweepPoint&, double* row);
+
+// writes the row of one point by typed column, complex values included:
+// row << x << omega stores a real and a complex column of the schema
+typedef void (*RowFunction)(const SweepPoint&, ResultRow& row);
+
 class Calculation {
 
 public:
 
   static bool nowork;
+  static bool binary_export;
+  static bool streaming;
+  static bool spill;
+  static bool use_cache;
+  static bool inline_data; // plot() streams 'data' to gnuplot instead of naming the file
+  static bool decimation; // plot() reduces sweeps larger than plot_pixels can show
+  static int plot_pixels; // resolution decimation aims at
+  static int threads;
+  static size_t batch_size;
   static std::string calc_path;
+  static Shard shard; // shard=k/N: this process computes part k of N of each grid
+  static int merge_shards; // merge=N: join the N parts of a sharded run instead of working
   std::string name;
   ParameterList parameters;
-  PlotScript* ps;
-  std::vector< std::vector<double> > data;
+  // the script of plot() while it runs, NULL otherwise, so plot command
+  // functions can configure it (calc.ps->set(...)). when plot() runs on
+  // several threads at once it is the one that started last
+  PlotScript* ps = NULL;
+  ResultTable data;
   std::vector< std::string > headers;
+  ResultSchema schema; // typed columns for RowFunction sweeps, sets headers
+  SweepStats stats; // of the last serial, parallel or batched sweep
+  std::vector< SweepListener* > listeners;
 
 
   Calculation(std::string name):name(name)
@@ -97,51 +213,369 @@ public:
 
   void work(VariableList variables, std::vector<double> (*iteration_func)())
   {
-    if (nowork) {
-      print_log("skip work.");
+    if (nowork || merge_shards > 0) {
+      skip_work();
     } else {
       print_log("begin work");
       list_parameters();
-      std::ofstream outfile; 
-      outfile.open(get_data_filepath());
-      outfile << concat_strings(headers, EXPORT_DELIMITER) << "\n";
-      iterate_recurse(iteration_func, variables, &outfile);
+      DataSink* sink = open_sink(variables);
+      open_cache();
+      for (int i = 0; i < listeners.size(); i++) listeners.at(i)->begin_sweep();
+      iterate_serial(iteration_func, variables, sink);
 
-      outfile.flush();
-      outfile.close();
+      close_sink(sink, variables);
+      close_cache();
       print_log("end work");
     }
   }
 
+  // parallel variant: the grid is flattened and split across 'threads' workers
+  // (0 means one per hardware thread). rows still arrive in serial order.
+  void work(VariableList variables, SweepFunction iteration_func)
+  {
+    if (nowork || merge_shards > 0) {
+      skip_work();
+    } else {
+      int num_workers = (threads < 1) ? ThreadPool::hardware_threads() : threads;
+      print_log("begin work ("+std::to_string(num_workers)+" threads)");
+      list_parameters();
+      ignore_listeners();
+      DataSink* sink = open_sink(variables);
+      open_cache();
+      iterate_parallel(iteration_func, variables, sink, num_workers);
+
+      close_sink(sink, variables);
+      close_cache();
+      print_log("end work");
+    }
+  }
+
+  // slot variant of the parallel sweep: rows are written straight into data
+  // (or a reused window block when streaming), one value per header.
+  void work(VariableList variables, SlotFunction iteration_func)
+  {
+    if (nowork || merge_shards > 0) {
+      skip_work();
+    } else {
+      int num_workers = (threads < 1) ? ThreadPool::hardware_threads() : threads;
+      print_log("begin work ("+std::to_string(num_workers)+" threads)");
+      list_parameters();
+      if (use_cache) print_log("cache is not used by slot sweeps");
+      ignore_listeners();
+      DataSink* sink = open_sink(variables);
+      iterate_slots(iteration_func, variables, sink, num_workers);
+
+      close_sink(sink, variables);
+      print_log("end work");
+    }
+  }
+
+  // typed slot variant: the row is written by schema column, each complex
+  // column into two adjacent doubles. without a schema, one is made from the
+  // headers (z.re, z.im pairs are complex), otherwise the schema sets them.
+  void work(VariableList variables, RowFunction iteration_func)
+  {
+    if (nowork || merge_shards > 0) {
+      skip_work();
+      if (schema.empty()) schema = ResultSchema::from_headers(headers);
+    } else {
+      if (schema.empty()) schema = ResultSchema::from_headers(headers);
+      else headers = schema.headers();
+      int num_workers = (threads < 1) ? ThreadPool::hardware_threads() : threads;
+      print_log("begin work ("+std::to_string(num_workers)+" threads)");
+      list_parameters();
+      if (use_cache) print_log("cache is not used by slot sweeps");
+      ignore_listeners();
+      DataSink* sink = open_sink(variables);
+      const ResultSchema& columns = schema;
+      iterate_slots([&columns, iteration_func](const SweepPoint& point, double* values) {
+        ResultRow row(columns, values);
+        iteration_func(point, row);
+      }, variables, sink, num_workers);
+
+      close_sink(sink, variables);
+      print_log("end work");
+    }
+  }
+
+  // batched variant: the kernel fills one column block per header for up to
+  // batch_size points at a time, on 'threads' workers.
+  void work(VariableList variables, BatchFunction iteration_func)
+  {
+    if (nowork || merge_shards > 0) {
+      skip_work();
+    } else {
+      int num_workers = (threads < 1) ? ThreadPool::hardware_threads() : threads;
+      print_log("begin batched work ("+std::to_string(num_workers)+" threads)");
+      list_parameters();
+      if (use_cache) print_log("cache is not used by batched sweeps");
+      ignore_listeners();
+      DataSink* sink = open_sink(variables);
+      iterate_batched(iteration_func, variables, sink, num_workers);
+
+      close_sink(sink, variables);
+      print_log("end work");
+    }
+  }
+
+
+  // compile-time specialised serial sweep: f is any callable taking one cd
+  // per axis, e.g. work_static([](cd x, cd y) { ... }, x, y), and returning a
+  // row with data() and size() (RowResult, or std::array<double,N> to avoid
+  // the allocation). the loop nest is generated for the fixed number of axes,
+  // so f is inlined and the axis values live in a local array. the shared
+  // Variables, listeners and the cache are not involved.
+  template <typename F, typename... Axes>
+  void work_static(F f, Axes&... axes)
+  {
+    if (nowork || merge_shards > 0) {
+      skip_work();
+    } else {
+      print_log("begin work");
+      list_parameters();
+      VariableList variables = { &axes... };
+      if (shard.active()) print_log("work_static does not shard, computing the whole grid");
+      ignore_listeners();
+      DataSink* sink = open_sink(variables, false);
+      std::array<std::vector<cd>, sizeof...(Axes)> points = { materialise(axes)... };
+      std::array<cd, sizeof...(Axes)> values;
+      loop_nest<0>(f, points, values, sink);
+
+      sink->close();
+      delete sink;
+      close_spill();
+      print_log("end work");
+    }
+  }
+
+  // sampled sweep: 'samples' points drawn from the variables' ranges by
+  // method instead of the full grid, with any iteration function work()
+  // takes. a variable's coordinate is spread between its first and last
+  // point following the spacing of its points, so samples are denser where
+  // the points are (a log grid gives roughly log-uniform samples). samples
+  // depend on the seed and their index only, not on threads or shards; rows
+  // are stored in sample order. a complex variable whose points span a
+  // num_real x num_imag rectangle (linspace/logspace with num_imag > 1) is
+  // sampled over the rectangle, its real and imaginary axes being two
+  // sample dimensions.
+  template <typename IterationFunction>
+  void work_sampled(VariableList variables, IterationFunction iteration_func,
+    Sampler::Method method, size_t samples, uint64_t seed = 0)
+  {
+    size_t dims = 0;
+    sample_imag.clear();
+    for (int i = 0; i < variables.size(); i++) {
+      if (variables.at(i)->num_points() == 0) { print_log("sampled work: "+variables.at(i)->name_label+" has no points"); return; }
+      sample_imag.push_back(complex_rectangle(*variables.at(i)));
+      dims += (sample_imag.back() > 1) ? 2 : 1;
+    }
+    Sampler points(method, dims, samples, seed);
+    if (!nowork && merge_shards == 0)
+      print_log("sampling "+std::to_string(samples)+" points ("+Sampler::name(points.get_method())+", seed "+std::to_string(seed)+")");
+    sampler = &points;
+    sampled_points = samples;
+    work(variables, iteration_func);
+    sampler = NULL;
+  }
+
+  // adaptive 1D sweep: starts from the variable's points and bisects the
+  // intervals whose midpoint deviates most from the linear interpolation of
+  // its ends, relative to each column's range, until every interval is within
+  // tolerance or max_points have been evaluated. rows are stored in order
+  // along the variable.
+  void work_adaptive(Variable& variable, SweepFunction iteration_func,
+    double tolerance, size_t max_points)
+  {
+    if (nowork || merge_shards > 0) { skip_work(); return; }
+    int num_workers = (threads < 1) ? ThreadPool::hardware_threads() : threads;
+    print_log("begin adaptive work ("+std::to_string(num_workers)+" threads)");
+    if (shard.active()) print_log("adaptive work does not shard, computing the whole sweep");
+    list_parameters();
+    ignore_listeners();
+    AdaptiveSweep sweep(this, VariableList(1, &variable), iteration_func, num_workers);
 
+    std::vector<size_t> coarse;
+    for (int i = 0; i < variable.num_points(); i++)
+      coarse.push_back(sweep.add(variable.point(i), i));
+    sweep.evaluate();
+    std::vector<double> scale = sweep.column_scales();
+
+    std::priority_queue<AdaptiveCell> cells;
+    std::vector<AdaptiveCell> split;
+    for (int i = 0; i+1 < coarse.size(); i++) split.push_back(interval(sweep, coarse[i], coarse[i+1]));
+    while (true) {
+      sweep.evaluate();
+      for (int i = 0; i < split.size(); i++) {
+        AdaptiveCell& c = split[i];
+        c.error = sweep.deviation(c.centre, c.corners, 2, scale);
+        if (c.error > tolerance) cells.push(c);
+      }
+      split.clear();
+      // bisect a batch of the worst intervals, every bisection costs two points
+      while (!cells.empty() && split.size() < 2*sweep.batch_size()
+        && sweep.size() + 2 <= max_points) {
+        AdaptiveCell c = cells.top(); cells.pop();
+        split.push_back(interval(sweep, c.corners[0], c.centre));
+        split.push_back(interval(sweep, c.centre, c.corners[1]));
+      }
+      if (split.empty()) break;
+    }
+    if (!cells.empty()) print_log("adaptive: point budget reached before tolerance");
+    sweep.store();
+    print_log("end work ("+std::to_string(sweep.size())+" points)");
+  }
+
+  // adaptive sweep of a complex variable over the rectangle spanned by
+  // lower_left and upper_right: starts from a num_real x num_imag grid and
+  // splits cells into four where the centre deviates from the mean of the
+  // corners. rows are stored sorted by real, then imaginary part.
+  void work_adaptive(Variable& variable, cd lower_left, cd upper_right,
+    int num_real, int num_imag, SweepFunction iteration_func,
+    double tolerance, size_t max_points)
+  {
+    if (nowork || merge_shards > 0) { skip_work(); return; }
+    int num_workers = (threads < 1) ? ThreadPool::hardware_threads() : threads;
+    print_log("begin adaptive work ("+std::to_string(num_workers)+" threads)");
+    if (shard.active()) print_log("adaptive work does not shard, computing the whole sweep");
+    list_parameters();
+    ignore_listeners();
+    AdaptiveSweep sweep(this, VariableList(1, &variable), iteration_func, num_workers);
+
+    std::vector<double> re = grid_lines(lower_left.real(), upper_right.real(), num_real);
+    std::vector<double> im = grid_lines(lower_left.imag(), upper_right.imag(), num_imag);
+    for (int r = 0; r < re.size(); r++)
+      for (int i = 0; i < im.size(); i++) sweep.at(re[r], im[i]);
+    sweep.evaluate();
+    std::vector<double> scale = sweep.column_scales();
+
+    std::priority_queue<AdaptiveCell> cells;
+    std::vector<AdaptiveCell> split;
+    for (int r = 0; r+1 < re.size(); r++)
+      for (int i = 0; i+1 < im.size(); i++) split.push_back(cell(sweep, re[r], re[r+1], im[i], im[i+1]));
+    while (true) {
+      sweep.evaluate();
+      for (int i = 0; i < split.size(); i++) {
+        AdaptiveCell& c = split[i];
+        c.error = sweep.deviation(c.centre, c.corners, 4, scale);
+        if (c.error > tolerance) cells.push(c);
+      }
+      split.clear();
+      // a split costs at most four edge midpoints plus four new centres
+      while (!cells.empty() && split.size() < 4*sweep.batch_size()
+        && sweep.size() + 8 <= max_points) {
+        AdaptiveCell c = cells.top(); cells.pop();
+        double re_mid = (c.re0+c.re1)/2., im_mid = (c.im0+c.im1)/2.;
+        split.push_back(cell(sweep, c.re0, re_mid, c.im0, im_mid));
+        split.push_back(cell(sweep, re_mid, c.re1, c.im0, im_mid));
+        split.push_back(cell(sweep, c.re0, re_mid, im_mid, c.im1));
+        split.push_back(cell(sweep, re_mid, c.re1, im_mid, c.im1));
+      }
+      if (split.empty()) break;
+    }
+    if (!cells.empty()) print_log("adaptive: point budget reached before tolerance");
+    sweep.store();
+    print_log("end work ("+std::to_string(sweep.size())+" points)");
+  }
+
+  // safe to call from several threads at once, also for the same Calculation
   void plot(PlotCommands (*plot_coms)(), std::string term = "png",
    bool export_script= false, std::string export_name = "") {
-    bool silent_state = PlotScript::silent; PlotScript::silent = true;
-    ps = new PlotScript(name, term);
+    if (shard.active()) { print_log("shard run, plot skipped until the merge"); return; }
+    PlotScript* ps = new PlotScript(name, term, true);
+    publish_script(ps, NULL);
     ps->r("cd '"+calc_path+name+"/'", true);
     if (export_name=="") ps->set_output(name);
     else ps->set_output(export_name);
     ps->set_separator(EXPORT_DELIMITER);
+    std::string data_file = name+".data";
+    PlotCommands comms;
+    if (plot_coms != NULL) comms = plot_coms();
+    ResultTable reduced;
+    if (decimation && decimate_rows(reduced, draws_map(comms))) data_file = name+".plot.data";
+    const ResultTable& rows = (data_file == name+".data") ? data : reduced;
+    std::string binary_spec = "";
+    if (data_file::is_binary(calc_path+name+"/"+data_file)) {
+      BinaryDataReader reader(calc_path+name+"/"+data_file);
+      if (reader.good()) binary_spec = reader.gnuplot_binary_spec();
+    }
     for (int i = 0; i < parameters.size(); i++)
       ps->append_parameter_info(parameters.at(i)->stringify(true));
     ps->set_parameter_info();
     if (plot_coms != NULL) {
-      PlotCommands comms = plot_coms();
+      bool send_inline = inline_data && !rows.empty();
       for (int i = 0; i<comms.size(); i++) {
         parse_header_names(comms.at(i));
-        parse_data_file_path(comms.at(i));
-        parse_styles(comms.at(i));
+        parse_styles(comms.at(i), ps);
+        if (send_inline && plot_inline(comms.at(i), rows, data_file, binary_spec, ps)) continue;
+        parse_data_file_path(comms.at(i), data_file, binary_spec);
         ps->r(comms.at(i));
       }
     }
-    PlotScript::silent = silent_state;
+    ps->quiet = false;
     ps->end();
     if (export_script) ps->export_script(calc_path+name+"/"+name+".plt");
+    publish_script(NULL, ps);
     delete(ps);
   }
 
+  // runs work() on its own thread. plots queued with plot_async() afterwards
+  // wait for it to finish. the Calculation and the variables must outlive it.
+  template <typename IterationFunction>
+  std::shared_future<void> work_async(VariableList variables, IterationFunction iteration_func) {
+    pending_work = std::async(std::launch::async, [this, variables, iteration_func]() {
+      work(variables, iteration_func);
+    }).share();
+    return pending_work;
+  }
+
+  // queues plot() on PlotQueue::shared(); it starts once the last work_async()
+  // and every future in 'after' are done. the Calculation must outlive it.
+  std::shared_future<void> plot_async(PlotCommands (*plot_coms)(), std::string term = "png",
+   bool export_script= false, std::string export_name = "",
+   std::vector< std::shared_future<void> > after = std::vector< std::shared_future<void> >()) {
+    if (pending_work.valid()) after.push_back(pending_work);
+    return PlotQueue::shared().submit([this, plot_coms, term, export_script, export_name]() {
+      plot(plot_coms, term, export_script, export_name);
+    }, after);
+  }
 
   std::string get_data_filepath() { return calc_path+name+"/"+name+".data"; }
+  std::string get_spill_filepath() { return calc_path+name+"/"+name+sink_shard.suffix()+".spill"; }
+  std::string get_cache_filepath() { return calc_path+name+"/"+name+sink_shard.suffix()+".cache"; }
+  std::string get_shard_filepath(const Shard& part) { return calc_path+name+"/"+name+part.suffix()+".data"; }
+
+  // refills data and headers from the .data file of an earlier run, text or
+  // binary; text files are parsed on 'threads' workers. used by nowork.
+  bool load_results() {
+    std::string path = get_data_filepath();
+    if (streaming) return false;
+    data.clear();
+    data_shape.clear();
+    if (data_file::is_binary(path)) {
+      BinaryDataReader reader(path);
+      if (!reader.good()) return false;
+      headers = reader.headers;
+      data_shape = reader.shape;
+      data.set_width(reader.columns());
+      data.assign(reader.records(), reader.rows());
+    } else {
+      TextDataReader reader(path);
+      if (!reader.good()) return false;
+      headers = reader.headers;
+      std::vector<double> values;
+      reader.read(values, threads);
+      data.assign(std::move(values), reader.columns());
+    }
+    print_log("loaded "+std::to_string(data.size())+" rows");
+    return true;
+  }
+
+  // rows of the last streamed sweep, which are not held in data: the binary
+  // .data file itself, or the spill file of a text sweep. caller deletes.
+  BinaryDataReader* open_results() {
+    if (data_file::is_binary(get_data_filepath())) return new BinaryDataReader(get_data_filepath());
+    return new BinaryDataReader(get_spill_filepath());
+  }
 
   void list_parameters()  {
     for (int i =0; i< parameters.size(); i++) {
@@ -152,22 +586,222 @@ public:
   }
 
   static void set_flags(int argc,char* argv[]) {
-    for (int i = 0; i < argc; ++i)
-      if ((std::string) argv[i]=="nowork") { nowork = true; break; }
+    for (int i = 0; i < argc; ++i) {
+      std::string arg = argv[i];
+      if (arg=="nowork") nowork = true;
+      else if (arg=="binary") binary_export = true;
+      else if (arg=="stream") streaming = true;
+      else if (arg=="spill") spill = true;
+      else if (arg=="cache") use_cache = true;
+      else if (arg=="inline") inline_data = true;
+      else if (arg=="decimate") decimation = true;
+      else if (arg=="incremental") PlotScript::incremental = true;
+      else if (arg.rfind("threads=", 0) == 0) {
+        if (!parse_count(arg.substr(8), 0, threads)) std::cout << "calc: bad threads " << arg.substr(8) << ", expected a count, 0 for every hardware thread" << std::endl;
+      }
+      else if (arg.rfind("shard=", 0) == 0) {
+        if (!shard.parse(arg.substr(6))) std::cout << "calc: bad shard " << arg.substr(6) << ", expected k/N with 0 <= k < N" << std::endl;
+      }
+      else if (arg=="strided") shard.strided = true;
+      else if (arg.rfind("merge=", 0) == 0) {
+        if (!parse_count(arg.substr(6), 1, merge_shards)) std::cout << "calc: bad merge " << arg.substr(6) << ", expected the number of parts N >= 1" << std::endl;
+      }
+    }
   }
 
 protected:
 private:
 
+  std::shared_future<void> pending_work;
+  std::vector<size_t> data_shape; // points per variable of the last sweep
+
+  DataSink* spill_sink = NULL; // disk-backed copy of streamed text rows
+  Shard sink_shard; // part of the grid the current sweep computes
+  const Sampler* sampler = NULL; // draws the points of a sampled sweep
+  size_t sampled_points = 0;
+  std::vector<size_t> sample_imag; // per variable: imaginary points of its rectangle, 1 for a line
+
+  // in streaming mode rows only pass through the sinks' fixed size buffers;
+  // with spill the rows of a text sweep are also kept in a binary spill file.
+  // a sharded sweep writes its rows to the part file of its shard.
+  DataSink* open_sink(const VariableList& variables, bool sharded = true) {
+    std::vector<size_t> shape;
+    size_t total = 1;
+    for (int i = 0; i < variables.size(); i++) {
+      shape.push_back(variables.at(i)->num_points());
+      total *= shape.back();
+    }
+    if (sampler) {
+      total = sampled_points;
+      shape = std::vector<size_t>(1, total);
+    }
+    data_shape = shape;
+    sink_shard = sharded ? shard : Shard();
+    // rows of a different width cannot share the table, so earlier rows
+    // are dropped when the headers changed
+    if (data.width() != headers.size()) {
+      if (!data.empty()) print_log("headers changed from "+std::to_string(data.width())+" to "
+        +std::to_string(headers.size())+" columns, dropping the "+std::to_string(data.size())+" rows held in data");
+      data.clear();
+      data.set_width(headers.size());
+    }
+    if (!streaming) data.reserve(data.size() + sink_shard.size(total));
+    if (streaming && spill && !binary_export)
+      spill_sink = new BinaryDataWriter(get_spill_filepath(), headers, shape);
+    else std::remove(get_spill_filepath().c_str());
+    std::string path = sink_shard.active() ? get_shard_filepath(sink_shard) : get_data_filepath();
+    std::remove((path+".info").c_str());
+    if (!binary_export) return new TextDataSink(path, headers);
+    return new BinaryDataWriter(path, headers, shape);
+  }
+
+  // a finished shard leaves <part>.info next to its part file for the merge
+  void close_sink(DataSink* sink, const VariableList& variables) {
+    sink->close();
+    finish_stats(variables, sink);
+    delete sink;
+    close_spill();
+    if (!sink_shard.active()) return;
+    size_t total = 1;
+    for (size_t d = 0; d < data_shape.size(); d++) total *= data_shape[d];
+    sink_shard.write_info(get_shard_filepath(sink_shard)+".info", total, sink_shard.size(total), data_shape);
+    print_log("shard "+std::to_string(sink_shard.index)+" of "+std::to_string(sink_shard.count)+" written");
+  }
+
+  // nowork runs reload the results of an earlier run, merge runs first join
+  // the parts of a sharded one into them
+  void skip_work() {
+    if (merge_shards > 0) merge(merge_shards);
+    else print_log("skip work.");
+    load_results();
+  }
+
+  /*
+   joins the parts of a run with shard=k/N, N = count, into <name>.data in
+   flat grid order: contiguous parts one after the other, strided parts
+   interleaved. every part needs its .info, which a shard only writes once
+   it has finished. the parts are kept, so a merge can be repeated.
+  */
+  bool merge(size_t count) {
+    std::vector<Shard> parts(count);
+    std::vector<size_t> shape;
+    size_t total = 0;
+    for (size_t k = 0; k < count; k++) {
+      Shard expected;
+      expected.index = k;
+      expected.count = count;
+      std::string path = get_shard_filepath(expected);
+      size_t part_total = 0, rows = 0;
+      std::vector<size_t> part_shape;
+      if (!parts[k].read_info(path+".info", part_total, rows, part_shape)) {
+        print_log("merge: "+path+" is missing or unfinished");
+        return false;
+      }
+      if (parts[k].index != k || parts[k].count != count || rows != parts[k].size(part_total)
+        || (k > 0 && (parts[k].strided != parts[0].strided || part_total != total))) {
+        print_log("merge: "+path+" is not part "+std::to_string(k)+" of the same "+std::to_string(count)+" shards");
+        return false;
+      }
+      total = part_total;
+      shape = part_shape;
+    }
+
+    std::vector<BinaryDataReader*> readers(count, (BinaryDataReader*) NULL);
+    std::vector<std::vector<double> > text_rows(count);
+    std::vector<const double*> records(count);
+    std::vector<std::string> part_headers;
+    bool binary = data_file::is_binary(get_shard_filepath(parts[0]));
+    bool good = true;
+    for (size_t k = 0; k < count && good; k++) {
+      std::string path = get_shard_filepath(parts[k]);
+      std::vector<std::string> names;
+      size_t rows = 0;
+      if (binary) {
+        readers[k] = new BinaryDataReader(path);
+        good = readers[k]->good();
+        names = readers[k]->headers;
+        rows = readers[k]->rows();
+        records[k] = readers[k]->records();
+      } else {
+        TextDataReader reader(path);
+        good = reader.good();
+        names = reader.headers;
+        reader.read(text_rows[k], threads);
+        rows = names.empty() ? 0 : text_rows[k].size()/names.size();
+        records[k] = text_rows[k].data();
+      }
+      if (k == 0) part_headers = names;
+      if (!good || names != part_headers || rows != parts[k].size(total)) {
+        print_log("merge: "+path+" does not match its .info");
+        good = false;
+      }
+    }
+
+    if (good) {
+      size_t columns = part_headers.size();
+      DataSink* sink = binary ? (DataSink*) new BinaryDataWriter(get_data_filepath(), part_headers, shape)
+        : (DataSink*) new TextDataSink(get_data_filepath(), part_headers);
+      if (parts[0].strided) {
+        for (size_t i = 0; i < total; i++) sink->write_row(records[i % count] + (i / count)*columns, columns);
+      } else {
+        for (size_t k = 0; k < count; k++)
+          for (size_t i = 0; i < parts[k].size(total); i++) sink->write_row(records[k] + i*columns, columns);
+      }
+      sink->close();
+      delete sink;
+      print_log("merged "+std::to_string(count)+" shards, "+std::to_string(total)+" rows");
+    }
+    for (size_t k = 0; k < count; k++) delete readers[k];
+    return good;
+  }
+
+  // with use_cache every computed row is logged under a hash of the parameter
+  // values and the point's variable values; an interrupted or extended sweep
+  // then only computes the points missing from the cache.
+  ResultCache* cache = NULL;
+  uint64_t parameters_hash;
+  size_t cache_hits, cache_misses;
+  static const size_t checkpoint_rows = 1024;
+
+  void open_cache() {
+    if (!use_cache) return;
+    cache = new ResultCache(get_cache_filepath());
+    cache_hits = cache_misses = 0;
+    parameters_hash = calc_util::hash_bytes(NULL, 0);
+    for (int i = 0; i < parameters.size(); i++) {
+      double value[2] = { parameters.at(i)->real(), parameters.at(i)->imag() };
+      parameters_hash = calc_util::hash_bytes(value, sizeof(value), parameters_hash);
+    }
+    print_log("cache: "+std::to_string(cache->size())+" rows on disk");
+  }
+
+  void close_cache() {
+    if (cache == NULL) return;
+    print_log("cache: "+std::to_string(cache_hits)+" points reused, "+std::to_string(cache_misses)+" computed");
+    delete cache;
+    cache = NULL;
+  }
+
+  uint64_t point_key(const std::vector<cd>& values) {
+    return calc_util::hash_bytes(values.data(), values.size()*sizeof(cd), parameters_hash);
+  }
+
+  void close_spill() {
+    if (spill_sink == NULL) return;
+    spill_sink->close();
+    delete spill_sink;
+    spill_sink = NULL;
+  }
+
   static std::string next_style_point(PlotScript* ps) {return "p "+ps->next_style("point"); }
   static std::string next_style_line(PlotScript* ps)  {return "l "+ps->next_style("line"); }
 
-  void parse_styles(std::string & data) {
-    findAndReplaceAll_func(data,"<p_style>",next_style_point);
-    findAndReplaceAll_func(data,"<l_style>",next_style_line);
+  void parse_styles(std::string & data, PlotScript* ps) {
+    findAndReplaceAll_func(data,"<p_style>",next_style_point, ps);
+    findAndReplaceAll_func(data,"<l_style>",next_style_line, ps);
   }
 
-  void findAndReplaceAll_func(std::string & data, std::string toSearch, std::string (*replace_func)(PlotScript* )) {
+  void findAndReplaceAll_func(std::string & data, std::string toSearch, std::string (*replace_func)(PlotScript* ), PlotScript* ps) {
     size_t pos = data.find(toSearch);
     while( pos != std::string::npos)	{
       std::string replaceStr = replace_func(ps);
@@ -181,12 +815,147 @@ private:
       calc_util::findAndReplaceAll(data, "<"+headers.at(j)+">",
         std::to_string(find_header_index_by_name(headers.at(j))+1) );
     }
+    // |z| and arg z of complex columns stored as z.re, z.im
+    ResultSchema columns = ResultSchema::from_headers(headers);
+    for (size_t c = 0; c < columns.size(); c++) {
+      if (!columns[c].complex) continue;
+      calc_util::findAndReplaceAll(data, "<"+columns[c].name+".abs>", columns.abs_expression(c));
+      calc_util::findAndReplaceAll(data, "<"+columns[c].name+".arg>", columns.arg_expression(c));
+    }
   }
 
-  void parse_data_file_path(std::string & data) {
-    calc_util::findAndReplaceAll(data,"<data_file_path>",name+".data");
+  void parse_data_file_path(std::string & data, const std::string& data_file, const std::string& binary_spec) {
+    std::string toSearch = "<data_file_path>";
+    std::string replaceStr = data_file;
+    size_t pos = data.find(toSearch);
+    while( pos != std::string::npos)	{
+      data.replace(pos, toSearch.size(), replaceStr);
+      pos += replaceStr.size();
+      // binary files need their record layout right after the quoted name
+      if (binary_spec != "" && pos < data.size() && (data[pos] == '\'' || data[pos] == '"')) {
+        data.insert(pos+1, " "+binary_spec);
+        pos += binary_spec.size()+2;
+      }
+      pos = data.find(toSearch, pos);
+    }
   }
 
+  // sends a plot, splot or stats command with every quoted <data_file_path>
+  // replaced by an inline binary block of rows, followed by one copy of the
+  // rows per block. the history keeps the file version, so an exported
+  // script still runs on its own. returns false for other commands.
+  bool plot_inline(const std::string& command, const ResultTable& data,
+    const std::string& data_file, const std::string& binary_spec, PlotScript* ps)
+  {
+    std::istringstream words(command);
+    std::string verb;
+    words >> verb;
+    if (verb != "plot" && verb != "splot" && verb != "stats" && verb != "p" && verb != "sp") return false;
+    size_t columns = data.width();
+    std::string format;
+    for (size_t j = 0; j < columns; j++) format += "%double";
+    std::string block = "'-' binary record="+std::to_string(data.size())+" format='"+format+"' endian="
+      +(data_file::host_little_endian() ? "little" : "big");
+    std::string inline_command = command;
+    int blocks = 0;
+    const char* quotes[] = { "'<data_file_path>'", "\"<data_file_path>\"" };
+    for (int q = 0; q < 2; q++) {
+      size_t pos = inline_command.find(quotes[q]);
+      for (; pos != std::string::npos; pos = inline_command.find(quotes[q], pos + block.size())) {
+        inline_command.replace(pos, std::string(quotes[q]).size(), block);
+        blocks++;
+      }
+    }
+    if (blocks == 0) return false;
+    std::string file_command = command;
+    parse_data_file_path(file_command, data_file, binary_spec);
+    parse_data_file_path(inline_command, data_file, binary_spec);
+    ps->r(file_command, false, false);
+    ps->r(inline_command, true);
+    for (int b = 0; b < blocks; b++) ps->send_data(data.records(), data.size()*columns*sizeof(double));
+    return true;
+  }
+
+  // whether the commands draw a map (splot, pm3d or 'with image'), whose
+  // cells can be averaged, rather than curves, whose peaks must survive
+  static bool draws_map(const PlotCommands& comms) {
+    for (size_t i = 0; i < comms.size(); i++) {
+      std::istringstream words(comms[i]);
+      std::string word, previous;
+      while (words >> word) {
+        if (word == "splot" || word == "sp" || word.find("pm3d") != std::string::npos) return true;
+        if ((previous == "with" || previous == "w") && word.rfind("image", 0) == 0) return true;
+        previous = word;
+      }
+    }
+    return false;
+  }
+
+  /*
+   rows of the last sweep (from data, or the results file when streaming)
+   reduced to what plot_pixels can show. for a map of a complete grid of two
+   or more variables the last two axes are averaged onto the pixel grid;
+   otherwise every curve keeps the min/max rows of each pixel column: each
+   line of the innermost variable on its own for a complete grid, all rows
+   as one curve else. the result is also written to <name>.plot.data for the
+   plot commands. returns false when no reduction is needed.
+  */
+  bool decimate_rows(ResultTable& reduced, bool map) {
+    if (headers.empty()) return false;
+    size_t columns = headers.size();
+    std::vector<size_t> shape = data_shape;
+    BinaryDataReader* reader = NULL;
+    size_t num_rows = data.size();
+    if (!data.empty() && data.width() != columns) return false;
+    if (data.empty()) {
+      reader = open_results();
+      if (!reader->good() || reader->columns() != columns) { delete reader; return false; }
+      num_rows = reader->rows();
+      shape = reader->shape;
+    }
+    const double* records = reader ? reader->records() : data.records();
+    auto get = [records, columns](size_t i, size_t j) { return records[i*columns + j]; };
+    decimate::Rows rows;
+    std::vector<size_t> axes;
+    size_t grid_points = 1;
+    for (size_t d = 0; d < shape.size(); d++) {
+      grid_points *= shape[d];
+      if (shape[d] > 1) axes.push_back(shape[d]);
+    }
+    size_t pixels = plot_pixels;
+    if (map && axes.size() >= 2 && grid_points == num_rows) {
+      if (axes[axes.size()-2] > pixels || axes.back() > pixels) rows = decimate::pixel_grid(axes, columns, pixels, get);
+    } else if (axes.size() >= 2 && grid_points == num_rows) {
+      size_t line = axes.back();
+      if (line > pixels*(2 + 2*columns)) {
+        for (size_t first = 0; first < num_rows; first += line) {
+          decimate::Rows kept = decimate::min_max(line, columns, pixels, [&get, first](size_t i, size_t j) {
+            return get(first + i, j);
+          });
+          rows.insert(rows.end(), kept.begin(), kept.end());
+        }
+        axes = std::vector<size_t>(1, rows.size());
+      }
+    } else if (num_rows > pixels*(2 + 2*columns)) {
+      rows = decimate::min_max(num_rows, columns, pixels, get);
+      axes = std::vector<size_t>(1, rows.size());
+    }
+    delete reader;
+    if (rows.empty()) return false;
+    reduced.set_width(columns);
+    reduced.reserve(rows.size());
+    for (size_t i = 0; i < rows.size(); i++) reduced.push_back(rows[i]);
+    print_log("decimate: "+std::to_string(num_rows)+" -> "+std::to_string(reduced.size())+" rows");
+    // written aside and renamed, so concurrent plots never see a partial file
+    std::string path = calc_path+name+"/"+name+".plot.data";
+    std::ostringstream part;
+    part << path << "." << std::this_thread::get_id();
+    BinaryDataWriter writer(part.str(), headers, axes);
+    for (size_t i = 0; i < reduced.size(); i++) writer.write_row(reduced[i].data(), columns);
+    writer.close();
+    std::rename(part.str().c_str(), path.c_str());
+    return true;
+  }
 
   int find_header_index_by_name(std::string header_name) {
     for (int i = 0; i < headers.size(); i++) {
@@ -209,28 +978,594 @@ private:
   }
 */
 
-  void iterate_recurse(std::vector<double> (*f)(),
-    VariableList &variables, std::ofstream* file_handle,
-    int depth=0)
+  // walks the grid in flat index order, the order of nested loops over the
+  // variables with the last one innermost, writing each point into the
+  // shared Variable objects
+  void iterate_serial(std::vector<double> (*f)(),
+    VariableList &variables, DataSink* sink)
+  {
+    std::vector<size_t> shape;
+    for (int i = 0; i < variables.size(); i++) shape.push_back(variables.at(i)->num_points());
+    ProductIndex index(shape);
+    size_t grid_points = sampler ? sampled_points : index.total();
+    size_t points = sink_shard.size(grid_points);
+    size_t first = sink_shard.first(grid_points), step = sink_shard.step();
+    if (!sampler) index.seek(first);
+    SweepPoint sample;
+    sample.coords.resize(variables.size());
+    sample.values.resize(variables.size());
+    stats.begin(points, shape, 1);
+    int changed = 0, last = (int) variables.size()-1;
+    if (sampler && !listeners.empty()) print_log("sampled sweep: listeners see every sample as a line of its own");
+    for (size_t n = 0; n < points; n++, changed = sampler ? 0 : shard_step(index))
+    {
+      if (sampler) {
+        place_point(sample, variables, shape, sink_shard.at(n, grid_points));
+        for (int d = 0; d < variables.size(); d++) *variables[d] = sample.values[d];
+      } else {
+        for (int d = changed; d < variables.size(); d++)
+          *variables[d] = variables[d]->point(index[d]);
+      }
+      // a line starts where an outer variable moved on, which also holds when
+      // a strided shard steps over the line's first point
+      if (sampler || n == 0 || changed < last)
+        for (int i = 0; i < listeners.size(); i++) listeners.at(i)->begin_line();
+      const std::vector<size_t>& coords = sampler ? sample.coords : index.coords();
+      calc_util::random_stream(first + n*step);
+
+      RowResult results_row;
+      if (cache) {
+        std::vector<cd> values(variables.size());
+        for (int i = 0; i < variables.size(); i++) values[i] = *variables[i];
+        uint64_t key = point_key(values);
+        if (cache->lookup(key, results_row)) {
+          cache_hits++;
+          for (int i = 0; i < listeners.size(); i++) listeners.at(i)->skipped();
+        }
+        else {
+          SweepStats::stamp t = SweepStats::now();
+          results_row = f();
+          stats.call(0, coords, t);
+          cache->store(key, results_row);
+          if (++cache_misses % checkpoint_rows == 0) cache->checkpoint();
+        }
+      }
+      else {
+        SweepStats::stamp t = SweepStats::now();
+        results_row = f();
+        stats.call(0, coords, t);
+      }
+      store_row(results_row, sink);
+      stats.stored(1);
+      if (n % 1024 == 0) report_progress();
+    }
+  }
+
+  // steps index to the shard's next point; returns the outermost axis whose
+  // coordinate changed on the way
+  int shard_step(ProductIndex& index) {
+    int changed = index.next();
+    for (size_t k = 1; k < sink_shard.step(); k++) changed = std::min(changed, index.next());
+    return changed;
+  }
+
+  // moves point to the shard's next point
+  void shard_advance(SweepPoint& point, VariableList &variables, const std::vector<size_t>& shape) {
+    if (sampler || sink_shard.step() > 1) place_point(point, variables, shape, point.index + sink_shard.step());
+    else next_point(point, variables, shape);
+  }
+
+  // puts point at flat index 'index' of the grid, or at sample 'index' of a
+  // sampled sweep: a coordinate u of a variable with n points lies between
+  // point floor(u*(n-1)) and the next one, linearly interpolated, and that
+  // point's index is the coordinate the statistics see
+  void place_point(SweepPoint& point, VariableList &variables, const std::vector<size_t>& shape, size_t index) {
+    if (!sampler) { set_point(point, variables, shape, index); return; }
+    point.index = index;
+    size_t dim = 0;
+    for (int d = 0; d < shape.size(); d++) {
+      const Variable& v = *variables[d];
+      size_t m = sample_imag[d], k, ki;
+      double f, fi;
+      if (m == 1) {
+        interpolate(sampler->unit(index, dim++), shape[d], k, f);
+        point.coords[d] = k;
+        point.values[d] = (f == 0.) ? v.point(k) : v.point(k)*(1.-f) + v.point(k+1)*f;
+        continue;
+      }
+      // rectangle: the real part along the first point of each row, the
+      // imaginary part along the first row
+      interpolate(sampler->unit(index, dim++), shape[d]/m, k, f);
+      interpolate(sampler->unit(index, dim++), m, ki, fi);
+      double re = (f == 0.) ? v.point(k*m).real() : v.point(k*m).real()*(1.-f) + v.point((k+1)*m).real()*f;
+      double im = (fi == 0.) ? v.point(ki).imag() : v.point(ki).imag()*(1.-fi) + v.point(ki+1).imag()*fi;
+      point.coords[d] = k*m + ki;
+      point.values[d] = cd(re, im);
+    }
+  }
+
+  // position u in [0,1) along n points: between point k and k+1 at fraction f
+  static void interpolate(double u, size_t n, size_t& k, double& f) {
+    double t = u*(n-1);
+    k = (size_t) t;
+    f = t - k;
+    if (k+1 >= n) { k = n-1; f = 0.; }
+  }
+
+  // num_imag if the points of v are a num_real x num_imag rectangle, imaginary
+  // part fastest, with num_real and num_imag above 1; 1 otherwise
+  static size_t complex_rectangle(const Variable& v) {
+    size_t n = v.num_points(), m = 1;
+    while (m < n && v.point(m).real() == v.point(0).real()) m++;
+    if (m == 1 || m == n || n % m != 0) return 1;
+    for (size_t i = 0; i < n; i++)
+      if (v.point(i).real() != v.point(i - i%m).real() || v.point(i).imag() != v.point(i%m).imag()) return 1;
+    return m;
+  }
+
+  // only the serial work() notifies listeners
+  void ignore_listeners() {
+    if (!listeners.empty()) print_log(std::to_string(listeners.size())+" listener(s) ignored, only the serial work() notifies them");
+  }
+
+  // sets the public ps to script, or clears it if it still is 'ending'
+  void publish_script(PlotScript* script, PlotScript* ending) {
+    static std::mutex ps_mutex;
+    std::lock_guard<std::mutex> lock(ps_mutex);
+    if (script || this->ps == ending) this->ps = script;
+  }
+
+  // a whole decimal number of at least 'least'; value is kept if malformed
+  static bool parse_count(const std::string& text, int least, int& value) {
+    try {
+      size_t used;
+      long n = std::stol(text, &used);
+      if (used != text.size() || n < least || n > INT_MAX) return false;
+      value = n;
+    } catch (...) { return false; }
+    return true;
+  }
+
+  void report_progress() {
+    std::string line = stats.progress();
+    if (line != "") print_log(line);
+  }
+
+  // logs the sweep's statistics and writes them next to the data file as
+  // <name>.stats.json and <name>.regions.csv
+  void finish_stats(const VariableList& variables, DataSink* sink) {
+    if (!SweepStats::enabled) return;
+    stats.end(sink->io_seconds + (spill_sink ? spill_sink->io_seconds : 0.));
+    print_log(stats.summary());
+    std::vector<std::string> names;
+    for (int i = 0; i < variables.size(); i++) names.push_back(variables.at(i)->name_label);
+    stats.write(calc_path+name+"/"+name+sink_shard.suffix(), names, [&variables](int d, size_t i) {
+      return variables.at(d)->point(i).real();
+    });
+  }
+
+  void store_row(const double* row, size_t n, DataSink* sink) {
+    if (!streaming) data.push_back(row, n);
+    sink->write_row(row, n);
+    if (spill_sink) spill_sink->write_row(row, n);
+  }
+
+  void store_row(const RowResult& results_row, DataSink* sink) {
+    if (!streaming) data.push_back(results_row);
+    //export data
+    sink->write_row(results_row.data(), results_row.size());
+    if (spill_sink) spill_sink->write_row(results_row.data(), results_row.size());
+  }
+
+  // computes the grid window by window: workers fill a window of rows in
+  // parallel, then the window is stored in flat index order.
+  void iterate_parallel(SweepFunction f, VariableList &variables,
+    DataSink* sink, int num_workers)
+  {
+    std::vector<size_t> shape;
+    size_t total = 1;
+    for (int i = 0; i < variables.size(); i++) {
+      shape.push_back(variables.at(i)->num_points());
+      total *= shape.back();
+    }
+    size_t grid_points = sampler ? sampled_points : total;
+    total = sink_shard.size(grid_points); // points of this shard
+    if (total == 0) return;
+
+    size_t grain = total / (num_workers * 16);
+    if (grain < 1) grain = 1;
+    if (grain > 1024) grain = 1024;
+    size_t window = grain * num_workers * 16;
+
+    std::vector<SweepPoint> contexts(num_workers);
+    for (int w = 0; w < num_workers; w++) {
+      contexts.at(w).coords.resize(variables.size());
+      contexts.at(w).values.resize(variables.size());
+      contexts.at(w).variables = &variables;
+    }
+    std::vector<RowResult> rows(window < total ? window : total);
+    std::vector<uint64_t> keys(cache ? rows.size() : 0);
+    stats.begin(total, shape, num_workers);
+    std::vector<char> computed(cache ? rows.size() : 0);
+
+    size_t start = 0;
+    ThreadPool::RangeFunction compute = [&](size_t begin, size_t end, int worker) {
+      SweepPoint& point = contexts[worker];
+      place_point(point, variables, shape, sink_shard.at(start + begin, grid_points));
+      for (size_t i = begin; i < end; i++) {
+        bool compute_row = true;
+        if (cache) {
+          keys[i] = point_key(point.values);
+          computed[i] = compute_row = !cache->lookup(keys[i], rows[i]);
+        }
+        if (compute_row) {
+          calc_util::random_stream(point.index);
+          SweepStats::stamp t = SweepStats::now();
+          rows[i] = f(point);
+          stats.call(worker, point.coords, t);
+        }
+        shard_advance(point, variables, shape);
+      }
+    };
+
+    ThreadPool* pool = (num_workers > 1) ? new ThreadPool(num_workers) : NULL;
+    for (; start < total; start += window) {
+      size_t n = (total - start < window) ? total - start : window;
+      if (pool) pool->parallel_for(n, grain, compute);
+      else compute(0, n, 0);
+      SweepStats::stamp t = SweepStats::now();
+      for (size_t i = 0; i < n; i++) store_row(rows[i], sink);
+      stats.stored(n, t);
+      report_progress();
+      if (cache) {
+        for (size_t i = 0; i < n; i++) {
+          if (!computed[i]) { cache_hits++; continue; }
+          cache->store(keys[i], rows[i]);
+          cache_misses++;
+        }
+        cache->checkpoint();
+      }
+    }
+    delete pool;
+  }
+
+  // as iterate_parallel, with the window's rows written in place: into data,
+  // whose reservation keeps them from moving, or into a reused block when
+  // streaming. the sinks then read the rows from there.
+  template <typename F>
+  void iterate_slots(F f, VariableList &variables,
+    DataSink* sink, int num_workers)
+  {
+    std::vector<size_t> shape;
+    size_t total = 1;
+    for (int i = 0; i < variables.size(); i++) {
+      shape.push_back(variables.at(i)->num_points());
+      total *= shape.back();
+    }
+    size_t grid_points = sampler ? sampled_points : total;
+    total = sink_shard.size(grid_points); // points of this shard
+    size_t width = data.width(); // set from the headers by open_sink
+    if (total == 0) return;
+    if (width == 0) { print_log("slot work needs headers"); return; }
+
+    size_t grain = total / (num_workers * 16);
+    if (grain < 1) grain = 1;
+    if (grain > 1024) grain = 1024;
+    size_t window = grain * num_workers * 16;
+
+    std::vector<SweepPoint> contexts(num_workers);
+    for (int w = 0; w < num_workers; w++) {
+      contexts.at(w).coords.resize(variables.size());
+      contexts.at(w).values.resize(variables.size());
+      contexts.at(w).variables = &variables;
+    }
+    std::vector<double> staging(streaming ? (window < total ? window : total)*width : 0);
+    stats.begin(total, shape, num_workers);
+
+    size_t start = 0;
+    double* block = NULL;
+    ThreadPool::RangeFunction compute = [&](size_t begin, size_t end, int worker) {
+      SweepPoint& point = contexts[worker];
+      place_point(point, variables, shape, sink_shard.at(start + begin, grid_points));
+      for (size_t i = begin; i < end; i++) {
+        calc_util::random_stream(point.index);
+        SweepStats::stamp t = SweepStats::now();
+        f(point, block + i*width);
+        stats.call(worker, point.coords, t);
+        shard_advance(point, variables, shape);
+      }
+    };
+
+    ThreadPool* pool = (num_workers > 1) ? new ThreadPool(num_workers) : NULL;
+    for (; start < total; start += window) {
+      size_t n = (total - start < window) ? total - start : window;
+      block = streaming ? staging.data() : data.append(n);
+      if (pool) pool->parallel_for(n, grain, compute);
+      else compute(0, n, 0);
+      SweepStats::stamp t = SweepStats::now();
+      for (size_t i = 0; i < n; i++) {
+        sink->write_row(block + i*width, width);
+        if (spill_sink) spill_sink->write_row(block + i*width, width);
+      }
+      stats.stored(n, t);
+      report_progress();
+    }
+    delete pool;
+  }
+
+  static std::vector<cd> materialise(const Variable& v) {
+    std::vector<cd> points(v.num_points());
+    for (size_t i = 0; i < points.size(); i++) points[i] = v.point(i);
+    return points;
+  }
+
+  template <size_t D, typename F, size_t N>
+  void loop_nest(F& f, const std::array<std::vector<cd>, N>& points,
+    std::array<cd, N>& values, DataSink* sink)
+  {
+    if constexpr (D == N) {
+      const auto& row = std::apply(f, values);
+      store_row(row.data(), row.size(), sink);
+    } else {
+      const cd* axis = points[D].data();
+      const size_t n = points[D].size();
+      for (size_t i = 0; i < n; i++) {
+        values[D] = axis[i];
+        loop_nest<D+1>(f, points, values, sink);
+      }
+    }
+  }
+
+  // per worker input and output blocks of a batched sweep
+  struct BatchBlock {
+    std::vector<AlignedBuffer*> buffers;
+    SweepBatch in;
+    BatchOutput out;
+    SweepPoint point; // walks the grid while the block is filled
+    std::vector<size_t> first_coords; // of the block's first point
+    ~BatchBlock() { for (int i = 0; i < buffers.size(); i++) delete buffers[i]; }
+  };
+
+  void iterate_batched(BatchFunction f, VariableList &variables,
+    DataSink* sink, int num_workers)
+  {
+    std::vector<size_t> shape;
+    size_t total = 1;
+    for (int i = 0; i < variables.size(); i++) {
+      shape.push_back(variables.at(i)->num_points());
+      total *= shape.back();
+    }
+    size_t grid_points = sampler ? sampled_points : total;
+    total = sink_shard.size(grid_points); // points of this shard
+    size_t num_columns = data.width(); // set from the headers by open_sink
+    if (total == 0) return;
+    if (num_columns == 0) { print_log("batched work needs headers"); return; }
+
+    size_t grain = (batch_size < 1) ? 1 : batch_size;
+    size_t padded = ((grain + CALC_SIMD_WIDTH-1)/CALC_SIMD_WIDTH)*CALC_SIMD_WIDTH;
+    size_t window = grain * num_workers * 4;
+
+    std::vector<BatchBlock> blocks(num_workers);
+    for (int w = 0; w < num_workers; w++) {
+      BatchBlock& b = blocks[w];
+      b.point.coords.resize(variables.size());
+      b.point.values.resize(variables.size());
+      b.point.variables = &variables;
+      for (size_t k = 0; k < 2*variables.size() + num_columns; k++) {
+        b.buffers.push_back(new AlignedBuffer(padded));
+        std::fill(b.buffers.back()->data(), b.buffers.back()->data()+padded, 0.);
+      }
+      for (int v = 0; v < variables.size(); v++) {
+        b.in.re.push_back(b.buffers[2*v]->data());
+        b.in.im.push_back(b.buffers[2*v+1]->data());
+      }
+      for (size_t j = 0; j < num_columns; j++)
+        b.out.columns.push_back(b.buffers[2*variables.size()+j]->data());
+    }
+    // row-major staging of one window, in flat index order
+    std::vector<double> rows((window < total ? window : total) * num_columns);
+    stats.begin(total, shape, num_workers);
+
+    size_t start = 0;
+    ThreadPool::RangeFunction compute = [&](size_t begin, size_t end, int worker) {
+      BatchBlock& b = blocks[worker];
+      size_t n = end - begin;
+      place_point(b.point, variables, shape, sink_shard.at(start + begin, grid_points));
+      b.first_coords = b.point.coords;
+      for (size_t i = 0; i < n; i++) {
+        for (int v = 0; v < variables.size(); v++) {
+          b.buffers[2*v]->data()[i] = b.point.values[v].real();
+          b.buffers[2*v+1]->data()[i] = b.point.values[v].imag();
+        }
+        shard_advance(b.point, variables, shape);
+      }
+      for (size_t i = n; i < padded; i++) {
+        for (int v = 0; v < 2*variables.size(); v++) b.buffers[v]->data()[i] = 0.;
+      }
+      b.in.first_index = sink_shard.at(start + begin, grid_points);
+      b.in.size = b.out.size = n;
+      b.in.padded = b.out.padded = padded;
+      calc_util::random_stream(b.in.first_index);
+      SweepStats::stamp t = SweepStats::now();
+      f(b.in, b.out);
+      stats.call(worker, b.first_coords, t, n);
+      for (size_t i = 0; i < n; i++)
+        for (size_t j = 0; j < num_columns; j++) rows[(begin+i)*num_columns + j] = b.out.columns[j][i];
+    };
+
+    ThreadPool* pool = (num_workers > 1) ? new ThreadPool(num_workers) : NULL;
+    for (; start < total; start += window) {
+      size_t n = (total - start < window) ? total - start : window;
+      if (pool) pool->parallel_for(n, grain, compute);
+      else for (size_t b = 0; b < n; b += grain) compute(b, (b+grain < n) ? b+grain : n, 0);
+      SweepStats::stamp t = SweepStats::now();
+      for (size_t i = 0; i < n; i++) store_row(&rows[i*num_columns], num_columns, sink);
+      stats.stored(n, t);
+      report_progress();
+    }
+    delete pool;
+  }
+
+  static void set_point(SweepPoint& point, VariableList &variables,
+    const std::vector<size_t>& shape, size_t index)
   {
-    if (depth < variables.size())
+    point.index = index;
+    ProductIndex::decode(shape, index, point.coords);
+    for (int d = 0; d < shape.size(); d++) point.values[d] = variables[d]->point(point.coords[d]);
+  }
+
+  // odometer step to the following flat index, cheaper than set_point
+  static void next_point(SweepPoint& point, VariableList &variables,
+    const std::vector<size_t>& shape)
+  {
+    point.index++;
+    int changed = ProductIndex::increment(shape, point.coords);
+    for (int d = changed; d < shape.size(); d++) point.values[d] = variables[d]->point(point.coords[d]);
+  }
+
+  // samples of an adaptive sweep. new points are queued by add()/at() and
+  // computed together by evaluate() on the pool.
+  class AdaptiveSweep {
+  public:
+    AdaptiveSweep(Calculation* calc, VariableList variables, SweepFunction f, int num_workers)
+    : calc(calc), variables(variables), f(f), contexts(num_workers)
     {
-      for (int i = 0; i < variables.at(depth)->points.size(); i++)
-      {
-        variables.at(depth)->real(variables.at(depth)->points.at(i).real());
-        variables.at(depth)->imag(variables.at(depth)->points.at(i).imag());
-        iterate_recurse(f, variables, file_handle, depth+1);
+      for (int w = 0; w < num_workers; w++) {
+        contexts[w].coords.resize(1);
+        contexts[w].values.resize(1);
+        contexts[w].variables = &this->variables;
       }
+      pool = (num_workers > 1) ? new ThreadPool(num_workers) : NULL;
     }
-    else
+    ~AdaptiveSweep() { delete pool; }
+
+    size_t size() const { return values.size(); }
+    size_t batch_size() const { return 16*contexts.size(); }
+
+    // order sorts the rows when they are stored
+    size_t add(cd value, double order) {
+      values.push_back(value);
+      orders.push_back(std::make_pair(order, 0.));
+      return values.size()-1;
+    }
+
+    // the order key of a midpoint sorts it between its ends
+    size_t midpoint(size_t a, size_t b) {
+      return add((values[a]+values[b])/2., (orders[a].first+orders[b].first)/2.);
+    }
+
+    // complex plane samples are shared between neighbouring cells
+    size_t at(double re, double im) {
+      std::pair<double,double> key(re, im);
+      std::map<std::pair<double,double>, size_t>::iterator it = plane.find(key);
+      if (it != plane.end()) return it->second;
+      values.push_back(cd(re, im));
+      orders.push_back(key);
+      return plane[key] = values.size()-1;
+    }
+
+    void evaluate() {
+      size_t begin = rows.size();
+      rows.resize(values.size());
+      ThreadPool::RangeFunction compute = [&](size_t b, size_t e, int worker) {
+        SweepPoint& point = contexts[worker];
+        for (size_t i = begin+b; i < begin+e; i++) {
+          point.index = point.coords[0] = i;
+          point.values[0] = values[i];
+          calc_util::random_stream(i);
+          rows[i] = f(point);
+        }
+      };
+      if (pool) pool->parallel_for(values.size()-begin, 4, compute);
+      else compute(0, values.size()-begin, 0);
+    }
+
+    std::vector<double> column_scales() const {
+      std::vector<double> lo, hi;
+      for (size_t i = 0; i < rows.size(); i++) {
+        for (size_t j = 0; j < rows[i].size(); j++) {
+          if (j >= lo.size()) { lo.push_back(rows[i][j]); hi.push_back(rows[i][j]); }
+          if (rows[i][j] < lo[j]) lo[j] = rows[i][j];
+          if (rows[i][j] > hi[j]) hi[j] = rows[i][j];
+        }
+      }
+      std::vector<double> scale(lo.size());
+      for (size_t j = 0; j < scale.size(); j++)
+        scale[j] = (hi[j] > lo[j] && std::isfinite(hi[j]-lo[j])) ? hi[j]-lo[j] : 1.;
+      return scale;
+    }
+
+    // largest relative distance of the centre row from the mean of the corner rows
+    double deviation(size_t centre, const size_t* corners, int num_corners,
+      const std::vector<double>& scale) const
     {
+      double error = 0;
+      for (size_t j = 0; j < scale.size() && j < rows[centre].size(); j++) {
+        double mean = 0;
+        for (int k = 0; k < num_corners; k++) mean += rows[corners[k]].at(j);
+        mean /= num_corners;
+        double e = std::abs(rows[centre][j] - mean)/scale[j];
+        if (e > error) error = e;
+      }
+      return error;
+    }
 
-      RowResult results_row = f();
-      data.push_back(results_row);
-      //export data
-      for (int i = 0; i < results_row.size(); i++) *file_handle << results_row.at(i) << EXPORT_DELIMITER;
-      if (results_row.size()>0) *file_handle << "\n";
+    void store() {
+      std::vector<size_t> order(values.size());
+      for (size_t i = 0; i < order.size(); i++) order[i] = i;
+      std::sort(order.begin(), order.end(), [this](size_t a, size_t b) { return orders[a] < orders[b]; });
+      DataSink* sink = calc->open_sink(variables, false);
+      for (size_t i = 0; i < order.size(); i++) calc->store_row(rows[order[i]], sink);
+      sink->close();
+      delete sink;
+      calc->close_spill();
     }
+
+  private:
+    Calculation* calc;
+    VariableList variables;
+    SweepFunction f;
+    std::vector<SweepPoint> contexts;
+    ThreadPool* pool;
+    std::vector<cd> values;
+    std::vector<std::pair<double,double> > orders;
+    std::vector<RowResult> rows;
+    std::map<std::pair<double,double>, size_t> plane;
+  };
+
+  // an interval (two corners) or a complex plane cell (four corners)
+  struct AdaptiveCell {
+    double error;
+    size_t centre;
+    size_t corners[4];
+    double re0, re1, im0, im1;
+    bool operator<(const AdaptiveCell& other) const { return error < other.error; }
+  };
+
+  static AdaptiveCell interval(AdaptiveSweep& sweep, size_t a, size_t b) {
+    AdaptiveCell c;
+    c.error = 0;
+    c.corners[0] = a; c.corners[1] = b;
+    c.centre = sweep.midpoint(a, b);
+    c.re0 = c.re1 = c.im0 = c.im1 = 0;
+    return c;
+  }
+
+  static AdaptiveCell cell(AdaptiveSweep& sweep, double re0, double re1, double im0, double im1) {
+    AdaptiveCell c;
+    c.error = 0;
+    c.re0 = re0; c.re1 = re1; c.im0 = im0; c.im1 = im1;
+    c.corners[0] = sweep.at(re0, im0); c.corners[1] = sweep.at(re1, im0);
+    c.corners[2] = sweep.at(re0, im1); c.corners[3] = sweep.at(re1, im1);
+    c.centre = sweep.at((re0+re1)/2., (im0+im1)/2.);
+    return c;
+  }
+
+  static std::vector<double> grid_lines(double start, double end, int num) {
+    std::vector<double> lines;
+    if (num < 2) num = 2;
+    for (int i = 0; i < num; i++) lines.push_back(start + (end-start)*i/(num-1));
+    return lines;
   }
 
   std::string concat_strings(std::vector<std::string> list, std::string delimiter) {
@@ -245,43 +1580,27 @@ private:
 };
 
 bool Calculation::nowork = false;
+bool Calculation::binary_export = false;
+bool Calculation::streaming = false;
+bool Calculation::spill = false;
+bool Calculation::use_cache = false;
+bool Calculation::inline_data = false;
+bool Calculation::decimation = false;
+int Calculation::plot_pixels = 1200; // the png term of gnuplot_terms
+int Calculation::threads = 1;
+Shard Calculation::shard;
+int Calculation::merge_shards = 0;
+size_t Calculation::batch_size = 256;
 std::string Calculation::calc_path = "calculations_output/";
 
 std::vector<cd> linspace(cd start, cd end, int num_real, int num_imag = 1)
 {
-  std::vector<cd> linspaced;
-  int num_real_spaces = (num_real < 2) ? 1 : num_real-1;
-  int num_imag_spaces = (num_imag < 2) ? 1 : num_imag-1;
-
-  for (int r = 0; r < num_real; r++)
-  {
-    double real_spaced = std::real(start+(double)r*((end-start)/(double)num_real_spaces));
-    for (int i = 0; i < num_imag; i++)
-    {
-      double imag_spaced = std::imag(start+(double)i*((end-start)/(double)num_imag_spaces));
-      linspaced.push_back(real_spaced + I*imag_spaced);
-    }
-  }
-  return linspaced;
+  return LinearGrid(start, end, num_real, num_imag).materialise();
 }
 
 std::vector<cd> logspace(cd start, cd end, int num_real, int num_imag = 1)
 {
-  std::vector<cd> logspaced;
-  std::vector<cd> real_pows = linspace(log10(start.real()), log10(end.real()), num_real);
-  std::vector<cd> imag_pows = linspace(log10(start.imag()), log10(end.imag()), num_imag);
-
-  for (int r = 0; r < num_real; r++)
-  {
-    for (int i = 0; i < num_imag; i++)
-    {
-      cd imag_part = pow(10., imag_pows.at(i));
-      if (num_imag == 1 && start.imag() == 0.0) imag_part = 0.0;
-      logspaced.push_back(pow(10.,real_pows.at(r))+I*imag_part );
-    }
-  }
-
-  return logspaced;
+  return LogGrid(start, end, num_real, num_imag).materialise();
 }
 
 
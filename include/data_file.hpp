@@ -0,0 +1,428 @@
+#ifndef DATA_FILE_H
+#define DATA_FILE_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <cstdio>
+#include <utility>
+#include <algorithm>
+#include <chrono>
+#include <charconv>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "thread_pool.hpp"
+
+#define EXPORT_DELIMITER " "
+#define BINARY_DATA_MAGIC "CALCBIN1"
+
+/*
+ binary .data layout, every field a little-endian uint64 unless noted:
+   char magic[8]             "CALCBIN1"
+   header_bytes              size of everything before the first record
+   num_columns
+   num_rows                  patched on close, readers also trust the file size
+   num_dims
+   shape[num_dims]           number of points of each variable
+   num_columns x (name_len, char name[name_len])
+   zero padding up to a multiple of 8 bytes
+ followed by num_rows records of num_columns doubles. records are stored
+ row-major because that is what gnuplot's binary reader consumes; columns are
+ exposed as strided views straight into the mapping.
+*/
+
+namespace data_file
+{
+  inline bool host_little_endian() {
+    const uint16_t probe = 1;
+    return *(const unsigned char*) &probe == 1;
+  }
+
+  template <typename T> void swap_bytes(T& value) {
+    unsigned char* b = (unsigned char*) &value;
+    for (int i = 0; i < sizeof(T)/2; i++) std::swap(b[i], b[sizeof(T)-1-i]);
+  }
+
+  inline bool is_binary(std::string filepath) {
+    std::ifstream in(filepath, std::ios::binary);
+    char magic[8] = {0};
+    in.read(magic, 8);
+    return in && std::memcmp(magic, BINARY_DATA_MAGIC, 8) == 0;
+  }
+}
+
+// destination for the rows of a sweep, in flat grid order
+class DataSink {
+public:
+  double io_seconds = 0.; // spent writing to the file, one clock pair per block
+
+  virtual ~DataSink() { }
+  virtual void write_row(const double* row, size_t n) = 0;
+  virtual void close() = 0;
+};
+
+// rows are formatted into a fixed size block that is written out when full,
+// so memory use does not depend on the number of rows. values are written
+// in the shortest form that reads back to the same double.
+class TextDataSink: public DataSink {
+public:
+  TextDataSink(std::string filepath, const std::vector<std::string>& headers)
+  : buffer(buffer_bytes), used(0)
+  {
+    outfile.open(filepath);
+    for (int i = 0; i < headers.size(); i++) {
+      outfile << headers.at(i);
+      if (i < headers.size()-1) outfile << EXPORT_DELIMITER;
+    }
+    outfile << "\n";
+  }
+  ~TextDataSink() { close(); }
+
+  void write_row(const double* row, size_t n) {
+    for (int i = 0; i < n; i++) {
+      if (buffer_bytes - used < max_cell_chars) flush_buffer();
+      char* end = std::to_chars(&buffer[used], &buffer[used] + max_cell_chars-1, row[i]).ptr;
+      *end++ = EXPORT_DELIMITER[0];
+      used = end - buffer.data();
+    }
+    if (n>0) {
+      if (used == buffer_bytes) flush_buffer();
+      buffer[used++] = '\n';
+    }
+  }
+
+  void close() {
+    if (!outfile.is_open()) return;
+    flush_buffer();
+    outfile.flush();
+    outfile.close();
+  }
+
+private:
+  static constexpr size_t buffer_bytes = 1 << 20;
+  static constexpr size_t max_cell_chars = 32;
+  std::ofstream outfile;
+  std::vector<char> buffer;
+  size_t used;
+
+  void flush_buffer() {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    outfile.write(buffer.data(), used);
+    used = 0;
+    io_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+  }
+};
+
+class BinaryDataWriter: public DataSink {
+public:
+  BinaryDataWriter(std::string filepath, const std::vector<std::string>& headers,
+    const std::vector<size_t>& shape)
+  : num_columns(headers.size()), num_rows(0)
+  {
+    outfile.open(filepath, std::ios::binary | std::ios::trunc);
+    std::vector<char> header;
+    header.insert(header.end(), BINARY_DATA_MAGIC, BINARY_DATA_MAGIC+8);
+    put(header, 0); // header_bytes, filled in below
+    put(header, num_columns);
+    put(header, 0);
+    put(header, shape.size());
+    for (int i = 0; i < shape.size(); i++) put(header, shape.at(i));
+    for (int i = 0; i < headers.size(); i++) {
+      put(header, headers.at(i).size());
+      header.insert(header.end(), headers.at(i).begin(), headers.at(i).end());
+    }
+    while (header.size() % 8 != 0) header.push_back(0);
+    uint64_t header_bytes = header.size();
+    if (!data_file::host_little_endian()) data_file::swap_bytes(header_bytes);
+    std::memcpy(&header[8], &header_bytes, 8);
+    outfile.write(header.data(), header.size());
+    buffer.resize(std::max<size_t>(buffer_bytes, 8*num_columns));
+  }
+  ~BinaryDataWriter() { close(); }
+
+  // rows must have num_columns entries; short rows are padded with NaN
+  void write_row(const double* row, size_t n) {
+    if (n != num_columns && !warned_width) {
+      std::cout << "binary data: row of " << n << " values for " << num_columns
+        << " headers, padding/truncating" << std::endl;
+      warned_width = true;
+    }
+    if (buffer.size() - used < 8*num_columns) flush_buffer();
+    for (size_t i = 0; i < num_columns; i++) {
+      double value = (i < n) ? row[i] : NAN;
+      if (!data_file::host_little_endian()) data_file::swap_bytes(value);
+      std::memcpy(&buffer[used], &value, 8);
+      used += 8;
+    }
+    num_rows++;
+  }
+
+  void close() {
+    if (!outfile.is_open()) return;
+    flush_buffer();
+    uint64_t rows = num_rows;
+    if (!data_file::host_little_endian()) data_file::swap_bytes(rows);
+    outfile.seekp(24);
+    outfile.write((const char*) &rows, 8);
+    outfile.flush();
+    outfile.close();
+  }
+
+private:
+  static constexpr size_t buffer_bytes = 1 << 20;
+  std::ofstream outfile;
+  std::vector<char> buffer;
+  size_t used = 0;
+  size_t num_columns;
+  size_t num_rows;
+  bool warned_width = false;
+
+  static void put(std::vector<char>& header, uint64_t value) {
+    if (!data_file::host_little_endian()) data_file::swap_bytes(value);
+    const char* bytes = (const char*) &value;
+    header.insert(header.end(), bytes, bytes+8);
+  }
+
+  void flush_buffer() {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    outfile.write(buffer.data(), used);
+    used = 0;
+    io_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+  }
+};
+
+// zero-copy view of one column: element i lives at data[i*stride]
+struct ColumnView {
+  const double* data;
+  size_t stride;
+  size_t length;
+
+  size_t size() const { return length; }
+  const double& operator[](size_t i) const { return data[i*stride]; }
+  const double& at(size_t i) const {
+    if (i >= length) std::cout << "column view: index out of range: " << i << std::endl;
+    return data[i*stride];
+  }
+};
+
+/*
+ reader for text .data files: a header line, then one row of delimited
+ numbers per line. the file is mapped and cut into chunks at line breaks,
+ which are parsed with std::from_chars on a thread pool and joined in order.
+*/
+class TextDataReader {
+public:
+  std::vector<std::string> headers;
+
+  TextDataReader(std::string filepath) {
+    int fd = ::open(filepath.c_str(), O_RDONLY);
+    if (fd == -1) {
+      std::cout << "text data: could not open " << filepath << std::endl;
+      return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      mapped_bytes = st.st_size;
+      void* m = mmap(NULL, mapped_bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (m != MAP_FAILED) mapping = (const char*) m;
+    }
+    ::close(fd);
+    if (mapping == NULL) return;
+    madvise((void*) mapping, mapped_bytes, MADV_SEQUENTIAL);
+    const char* end = mapping + mapped_bytes;
+    body = std::find(mapping, end, '\n');
+    for (const char* p = mapping; p < body; ) {
+      while (p < body && is_separator(*p)) p++;
+      const char* q = p;
+      while (q < body && !is_separator(*q)) q++;
+      if (q > p) headers.push_back(std::string(p, q));
+      p = q;
+    }
+    if (body < end) body++;
+  }
+  ~TextDataReader() { if (mapping) munmap((void*) mapping, mapped_bytes); }
+
+  bool good() const { return mapping != NULL; }
+  size_t columns() const { return headers.size(); }
+
+  // appends every row to values, row-major with columns() values per row,
+  // parsed on 'threads' workers (0: one per hardware thread). cells that are
+  // not numbers read as NaN, as do the missing cells of short rows; extra
+  // cells are dropped.
+  void read(std::vector<double>& values, int threads = 0) {
+    if (mapping == NULL) return;
+    const char* end = mapping + mapped_bytes;
+    int num_workers = (threads < 1) ? ThreadPool::hardware_threads() : threads;
+    size_t num_chunks = (end - body) / chunk_bytes + 1;
+    std::vector<const char*> bounds(num_chunks+1, end);
+    bounds[0] = body;
+    for (size_t k = 1; k < num_chunks; k++) {
+      const char* p = body + k*chunk_bytes;
+      bounds[k] = (p < bounds[k-1]) ? bounds[k-1] : std::find(p, end, '\n');
+      if (bounds[k] < end) bounds[k]++;
+    }
+    std::vector<std::vector<double> > parts(num_chunks);
+    ThreadPool::RangeFunction parse = [&](size_t begin, size_t stop, int) {
+      for (size_t k = begin; k < stop; k++) parse_chunk(bounds[k], bounds[k+1], parts[k]);
+    };
+    if (num_workers > 1 && num_chunks > 1) {
+      ThreadPool pool(num_workers);
+      pool.parallel_for(num_chunks, 1, parse);
+    }
+    else parse(0, num_chunks, 0);
+    size_t total = values.size();
+    for (size_t k = 0; k < num_chunks; k++) total += parts[k].size();
+    values.reserve(total);
+    for (size_t k = 0; k < num_chunks; k++) {
+      values.insert(values.end(), parts[k].begin(), parts[k].end());
+      std::vector<double>().swap(parts[k]);
+    }
+  }
+
+private:
+  TextDataReader(TextDataReader const&) = delete;
+  void operator=(TextDataReader const&) = delete;
+
+  static constexpr size_t chunk_bytes = 4 << 20;
+  const char* mapping = NULL;
+  const char* body = NULL; // first byte after the header line
+  size_t mapped_bytes = 0;
+
+  static bool is_separator(char c) {
+    return c == EXPORT_DELIMITER[0] || c == ' ' || c == '\t' || c == '\r';
+  }
+
+  void parse_chunk(const char* p, const char* end, std::vector<double>& values) const {
+    size_t width = columns();
+    values.reserve((end - p)/8);
+    while (p < end) {
+      const char* line_end = std::find(p, end, '\n');
+      size_t row_start = values.size(), cells = 0;
+      while (p < line_end) {
+        while (p < line_end && is_separator(*p)) p++;
+        if (p == line_end) break;
+        double value;
+        std::from_chars_result r = std::from_chars(p, line_end, value);
+        if (r.ec == std::errc()) p = r.ptr;
+        else if (r.ec == std::errc::result_out_of_range) {
+          // subnormals and overflow, which strtod rounds as the writer intended
+          value = std::strtod(std::string(p, r.ptr).c_str(), NULL);
+          p = r.ptr;
+        }
+        else {
+          value = NAN;
+          while (p < line_end && !is_separator(*p)) p++;
+        }
+        if (cells++ < width) values.push_back(value);
+      }
+      if (cells > 0)
+        for (size_t j = cells; j < width; j++) values.push_back(NAN);
+      else values.resize(row_start);
+      p = line_end + 1;
+    }
+  }
+};
+
+class BinaryDataReader {
+public:
+  std::vector<std::string> headers;
+  std::vector<size_t> shape;
+
+  BinaryDataReader(std::string filepath) {
+    if (!data_file::host_little_endian()) {
+      std::cout << "binary data: big-endian hosts are not supported" << std::endl;
+      return;
+    }
+    int fd = ::open(filepath.c_str(), O_RDONLY);
+    if (fd == -1) {
+      std::cout << "binary data: could not open " << filepath << std::endl;
+      return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size >= 48) {
+      mapped_bytes = st.st_size;
+      void* m = mmap(NULL, mapped_bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (m != MAP_FAILED) mapping = (const char*) m;
+    }
+    ::close(fd);
+    if (mapping == NULL || std::memcmp(mapping, BINARY_DATA_MAGIC, 8) != 0) {
+      std::cout << "binary data: not a binary data file: " << filepath << std::endl;
+      unmap();
+      return;
+    }
+
+    size_t pos = 8;
+    header_bytes = get(pos);
+    size_t num_columns = get(pos);
+    get(pos); // num_rows, recomputed from the file size below
+    size_t num_dims = get(pos);
+    for (size_t i = 0; i < num_dims; i++) shape.push_back(get(pos));
+    for (size_t i = 0; i < num_columns; i++) {
+      size_t len = get(pos);
+      if (pos + len > mapped_bytes) break;
+      headers.push_back(std::string(mapping+pos, len));
+      pos += len;
+    }
+    if (num_columns > 0 && header_bytes <= mapped_bytes)
+      num_rows = (mapped_bytes - header_bytes) / (8*num_columns);
+  }
+  ~BinaryDataReader() { unmap(); }
+
+  bool good() const { return mapping != NULL; }
+  size_t rows() const { return num_rows; }
+  size_t columns() const { return headers.size(); }
+  size_t data_offset() const { return header_bytes; }
+
+  const double* records() const { return (const double*) (mapping + header_bytes); }
+
+  ColumnView column(size_t j) const {
+    ColumnView view = { records()+j, columns(), num_rows };
+    return view;
+  }
+
+  ColumnView column(std::string name) const {
+    for (int j = 0; j < headers.size(); j++)
+      if (headers.at(j) == name) return column(j);
+    std::cout << "binary data: no column named " << name << std::endl;
+    ColumnView empty = { NULL, 0, 0 };
+    return empty;
+  }
+
+  // gnuplot modifiers that follow the quoted file name in a plot command
+  std::string gnuplot_binary_spec() const {
+    std::string format;
+    for (int j = 0; j < columns(); j++) format += "%double";
+    return "binary skip="+std::to_string(header_bytes)+" format='"+format+"' endian=little";
+  }
+
+private:
+  BinaryDataReader(BinaryDataReader const&) = delete;
+  void operator=(BinaryDataReader const&) = delete;
+
+  const char* mapping = NULL;
+  size_t mapped_bytes = 0;
+  size_t header_bytes = 0;
+  size_t num_rows = 0;
+
+  uint64_t get(size_t& pos) {
+    uint64_t value = 0;
+    if (pos + 8 <= mapped_bytes) std::memcpy(&value, mapping+pos, 8);
+    pos += 8;
+    return value;
+  }
+
+  void unmap() {
+    if (mapping) munmap((void*) mapping, mapped_bytes);
+    mapping = NULL;
+  }
+};
+
+#endif // DATA_FILE_H
@@ -0,0 +1,103 @@
+#ifndef DECIMATE_H
+#define DECIMATE_H
+
+#include <vector>
+#include <cstddef>
+#include <cmath>
+#include <algorithm>
+
+/*
+ reductions of a sweep's rows to what a plot of a given pixel resolution can
+ show. rows are read through get(i, j), the value of column j in row i, so
+ they can come from memory or from a mapped binary data file.
+*/
+namespace decimate {
+
+  typedef std::vector<std::vector<double> > Rows;
+
+  /*
+   line plots: the rows are split into 'buckets' runs of consecutive rows
+   (one per pixel column when the sweep variable is on the x axis) and each
+   run keeps its first and last row and the rows where some column has its
+   minimum or maximum, in their original order. every curve keeps its
+   envelope, so the drawn lines cover the same pixels as the full data.
+  */
+  template <typename Get>
+  Rows min_max(size_t rows, size_t columns, size_t buckets, Get get) {
+    Rows reduced;
+    if (buckets == 0) return reduced;
+    std::vector<size_t> keep;
+    for (size_t b = 0; b < buckets; b++) {
+      size_t begin = b*rows/buckets, end = (b+1)*rows/buckets;
+      if (begin == end) continue;
+      keep.clear();
+      keep.push_back(begin);
+      keep.push_back(end-1);
+      for (size_t j = 0; j < columns; j++) {
+        size_t lo = begin, hi = begin;
+        double lo_v = NAN, hi_v = NAN;
+        for (size_t i = begin; i < end; i++) {
+          double v = get(i, j);
+          if (std::isnan(v)) continue;
+          if (!(lo_v <= v)) { lo = i; lo_v = v; }
+          if (!(hi_v >= v)) { hi = i; hi_v = v; }
+        }
+        keep.push_back(lo);
+        keep.push_back(hi);
+      }
+      std::sort(keep.begin(), keep.end());
+      keep.erase(std::unique(keep.begin(), keep.end()), keep.end());
+      for (size_t k = 0; k < keep.size(); k++) {
+        std::vector<double> row(columns);
+        for (size_t j = 0; j < columns; j++) row[j] = get(keep[k], j);
+        reduced.push_back(row);
+      }
+    }
+    return reduced;
+  }
+
+  /*
+   maps: the last two axes of a sweep of the given shape are averaged in
+   blocks so that neither exceeds 'pixels' points; NaN cells are left out of
+   the averages. every leading axis is kept, one reduced map per slice.
+   'shape' is replaced by the reduced shape.
+  */
+  template <typename Get>
+  Rows pixel_grid(std::vector<size_t>& shape, size_t columns, size_t pixels, Get get) {
+    Rows reduced;
+    int d = shape.size();
+    if (d < 2 || pixels == 0) return reduced;
+    size_t na = shape[d-2], nb = shape[d-1];
+    size_t slices = 1;
+    for (int k = 0; k < d-2; k++) slices *= shape[k];
+    size_t fa = (na + pixels-1)/pixels, fb = (nb + pixels-1)/pixels;
+    size_t ra = (na + fa-1)/fa, rb = (nb + fb-1)/fb;
+    std::vector<double> sum(columns);
+    std::vector<size_t> count(columns);
+    for (size_t s = 0; s < slices; s++)
+      for (size_t a = 0; a < ra; a++)
+        for (size_t b = 0; b < rb; b++) {
+          std::fill(sum.begin(), sum.end(), 0.);
+          std::fill(count.begin(), count.end(), 0);
+          for (size_t i = a*fa; i < std::min(na, (a+1)*fa); i++)
+            for (size_t k = b*fb; k < std::min(nb, (b+1)*fb); k++) {
+              size_t row = (s*na + i)*nb + k;
+              for (size_t j = 0; j < columns; j++) {
+                double v = get(row, j);
+                if (std::isnan(v)) continue;
+                sum[j] += v;
+                count[j]++;
+              }
+            }
+          std::vector<double> mean(columns);
+          for (size_t j = 0; j < columns; j++) mean[j] = count[j] ? sum[j]/count[j] : NAN;
+          reduced.push_back(mean);
+        }
+    shape[d-2] = ra;
+    shape[d-1] = rb;
+    return reduced;
+  }
+
+}
+
+#endif // DECIMATE_H
@@ -0,0 +1,80 @@
+#ifndef DUAL_H
+#define DUAL_H
+
+#include <complex>
+#include <cmath>
+
+/*
+ forward-mode automatic differentiation: v + d*eps with eps^2 = 0, so
+ evaluating f(Dual(z, 1)) gives f(z) in v and f'(z) in d in one pass.
+ write the function as a template (or generic lambda) and call the maths
+ functions unqualified, e.g. exp(z) rather than std::exp(z), so the
+ overloads below are found for Dual arguments. the std:: versions take no
+ Dual, so a qualified call is a compile error rather than a quiet fallback
+ to another derivative.
+*/
+template <typename T = std::complex<double> >
+struct Dual {
+  T v;
+  T d;
+
+  Dual(): v(0.), d(0.) { }
+  Dual(T v, T d = T(0.)): v(v), d(d) { }
+  Dual(double v): v(v), d(0.) { }
+
+  Dual& operator+=(const Dual& b) { v += b.v; d += b.d; return *this; }
+  Dual& operator-=(const Dual& b) { v -= b.v; d -= b.d; return *this; }
+  Dual& operator*=(const Dual& b) { d = d*b.v + v*b.d; v *= b.v; return *this; }
+  Dual& operator/=(const Dual& b) { d = (d*b.v - v*b.d)/(b.v*b.v); v /= b.v; return *this; }
+};
+
+template <typename T> Dual<T> operator-(const Dual<T>& a) { return Dual<T>(-a.v, -a.d); }
+
+template <typename T> Dual<T> operator+(Dual<T> a, const Dual<T>& b) { return a += b; }
+template <typename T> Dual<T> operator-(Dual<T> a, const Dual<T>& b) { return a -= b; }
+template <typename T> Dual<T> operator*(Dual<T> a, const Dual<T>& b) { return a *= b; }
+template <typename T> Dual<T> operator/(Dual<T> a, const Dual<T>& b) { return a /= b; }
+
+// constants: T or double on either side
+template <typename T> Dual<T> operator+(const Dual<T>& a, const T& c) { return Dual<T>(a.v + c, a.d); }
+template <typename T> Dual<T> operator+(const T& c, const Dual<T>& a) { return Dual<T>(c + a.v, a.d); }
+template <typename T> Dual<T> operator-(const Dual<T>& a, const T& c) { return Dual<T>(a.v - c, a.d); }
+template <typename T> Dual<T> operator-(const T& c, const Dual<T>& a) { return Dual<T>(c - a.v, -a.d); }
+template <typename T> Dual<T> operator*(const Dual<T>& a, const T& c) { return Dual<T>(a.v*c, a.d*c); }
+template <typename T> Dual<T> operator*(const T& c, const Dual<T>& a) { return Dual<T>(c*a.v, c*a.d); }
+template <typename T> Dual<T> operator/(const Dual<T>& a, const T& c) { return Dual<T>(a.v/c, a.d/c); }
+template <typename T> Dual<T> operator/(const T& c, const Dual<T>& a) { return Dual<T>(c/a.v, -c*a.d/(a.v*a.v)); }
+
+template <typename T> Dual<T> operator+(const Dual<T>& a, double c) { return a + T(c); }
+template <typename T> Dual<T> operator+(double c, const Dual<T>& a) { return T(c) + a; }
+template <typename T> Dual<T> operator-(const Dual<T>& a, double c) { return a - T(c); }
+template <typename T> Dual<T> operator-(double c, const Dual<T>& a) { return T(c) - a; }
+template <typename T> Dual<T> operator*(const Dual<T>& a, double c) { return a * T(c); }
+template <typename T> Dual<T> operator*(double c, const Dual<T>& a) { return T(c) * a; }
+template <typename T> Dual<T> operator/(const Dual<T>& a, double c) { return a / T(c); }
+template <typename T> Dual<T> operator/(double c, const Dual<T>& a) { return T(c) / a; }
+
+// chain rule: f(a) with f'(a.v) = df
+template <typename T> Dual<T> chain(const Dual<T>& a, const T& f, const T& df) { return Dual<T>(f, df*a.d); }
+
+template <typename T> Dual<T> exp(const Dual<T>& a) { T e = std::exp(a.v); return chain(a, e, e); }
+template <typename T> Dual<T> log(const Dual<T>& a) { return chain(a, std::log(a.v), T(1.)/a.v); }
+template <typename T> Dual<T> sqrt(const Dual<T>& a) { T r = std::sqrt(a.v); return chain(a, r, T(0.5)/r); }
+template <typename T> Dual<T> sin(const Dual<T>& a) { return chain(a, std::sin(a.v), std::cos(a.v)); }
+template <typename T> Dual<T> cos(const Dual<T>& a) { return chain(a, std::cos(a.v), -std::sin(a.v)); }
+template <typename T> Dual<T> tan(const Dual<T>& a) { T t = std::tan(a.v); return chain(a, t, T(1.) + t*t); }
+template <typename T> Dual<T> sinh(const Dual<T>& a) { return chain(a, std::sinh(a.v), std::cosh(a.v)); }
+template <typename T> Dual<T> cosh(const Dual<T>& a) { return chain(a, std::cosh(a.v), std::sinh(a.v)); }
+template <typename T> Dual<T> tanh(const Dual<T>& a) { T t = std::tanh(a.v); return chain(a, t, T(1.) - t*t); }
+
+template <typename T> Dual<T> pow(const Dual<T>& a, double n) {
+  if (n == 0.) return Dual<T>(T(1.));
+  return chain(a, std::pow(a.v, n), n*std::pow(a.v, n-1.));
+}
+template <typename T> Dual<T> pow(const Dual<T>& a, int n) {
+  if (n == 0) return Dual<T>(T(1.));
+  return chain(a, std::pow(a.v, n), T((double) n)*std::pow(a.v, n-1));
+}
+template <typename T> Dual<T> pow(const Dual<T>& a, const Dual<T>& b) { return exp(b*log(a)); }
+
+#endif // DUAL_H
@@ -34,8 +34,18 @@ public:
         else
             std::cout << "succeded." << std::endl;
     }
+    inline GnuplotPipe(const std::string& command) {
+        pipe = popen(command.c_str(), "w");
+        if (!pipe)
+            std::cout << "Opening " << command << " failed!" << std::endl;
+    }
+    inline GnuplotPipe(std::nullptr_t) : pipe(NULL) { }
+    // a stream opened elsewhere (the stdin of a gnuplot forked by the
+    // caller), closed with fclose instead of pclose
+    inline explicit GnuplotPipe(FILE* stream) : pipe(stream), popened(false) { }
     inline virtual ~GnuplotPipe(){
-        if (pipe) pclose(pipe);
+        if (pipe && popened) pclose(pipe);
+        else if (pipe) fclose(pipe);
     }
 
     void sendLine(const std::string& text, bool useBuffer = false){
@@ -54,6 +64,13 @@ public:
         fflush(pipe);
         buffer.clear();
     }
+    void sendBinary(const void* data, size_t bytes){
+        if (pipe && bytes) fwrite(data, 1, bytes, pipe);
+    }
+    void flush(){
+        if (pipe) fflush(pipe);
+    }
+    bool good() const { return pipe != NULL; }
     void sendNewDataBlock(){
         sendLine("\n", !buffer.empty());
     }
@@ -69,5 +86,6 @@ private:
     void operator=(GnuplotPipe const&) = delete;
 
     FILE* pipe;
+    bool popened = true;
     std::vector<std::string> buffer;
 };
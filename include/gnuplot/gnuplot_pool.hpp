@@ -0,0 +1,282 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <cstdio>
+#include <cmath>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "gnuplot.hpp"
+#include "gnuplot_styles.hpp"
+#include "gnuplot_terms.hpp"
+
+/*
+ long-lived gnuplot processes shared by PlotScripts. a worker holds the style
+ commands in the gnuplot string variable calc_styles, so a lease costs a
+ 'reset', the term preamble and an 'eval calc_styles'. the preamble is
+ replayed on every lease because it also sets non-terminal state (the key
+ of epslatex) that 'reset' clears; a fresh process would have it. leases
+ block while max_workers processes are busy, and prefer a worker that last
+ served the same term. the pool forks gnuplot itself, so it also reads the
+ process's stdout: sync() prints a token there and waits for it. a worker
+ that exits, or does not answer within sync_timeout, is killed and retired
+ on release instead of being leased again. SIGPIPE is blocked on the leasing
+ thread from lease() to release(), which have to be called on the same
+ thread, so writing to a gnuplot that crashed does not end the program. the
+ processes are closed (and finish rendering) when the pool is destroyed at
+ exit.
+*/
+class GnuplotPool {
+public:
+  static std::string command;
+  static int max_workers;
+
+  static double sync_timeout; // seconds sync() waits for a render
+
+  struct Worker {
+    GnuplotPipe* pipe; // gnuplot's stdin
+    pid_t pid; // -1 once the process is reaped
+    int reply; // read end of gnuplot's stdout
+    std::string received; // from reply, not yet a complete line
+    unsigned long syncs;
+    std::string term;
+    bool busy;
+    bool broken; // exited or timed out: retired on release
+    int id;
+    sigset_t caller_mask; // of the leasing thread, restored on release
+  };
+
+  static GnuplotPool& shared() {
+    static GnuplotPool pool;
+    return pool;
+  }
+
+  ~GnuplotPool() {
+    for (int i = 0; i < workers.size(); i++) {
+      Worker* w = workers.at(i);
+      if (w->broken || !alive(w)) { retire(w); continue; }
+      without_sigpipe([w]{ w->pipe->sendLine("exit"); delete w->pipe; });
+      waitpid(w->pid, NULL, 0);
+      close(w->reply);
+      delete w;
+    }
+  }
+
+  // a clean gnuplot session with the preamble of term loaded
+  Worker* lease(std::string term) {
+    std::unique_lock<std::mutex> lock(mutex);
+    Worker* w = NULL;
+    while (w == NULL) {
+      for (int i = 0; i < workers.size(); i++) {
+        Worker* candidate = workers.at(i);
+        if (candidate->busy) continue;
+        if (!alive(candidate)) {
+          std::cout << "gnuplot pool: worker " << candidate->id << " has exited, starting another" << std::endl;
+          workers.erase(workers.begin() + i--);
+          retire(candidate);
+          continue;
+        }
+        if (w == NULL || (candidate->term == term && w->term != term)) w = candidate;
+      }
+      if (w == NULL && workers.size() < limit()) w = spawn();
+      if (w == NULL) released.wait(lock);
+    }
+    w->busy = true;
+    lock.unlock();
+    sigset_t pipe_signal = sigpipe();
+    pthread_sigmask(SIG_BLOCK, &pipe_signal, &w->caller_mask);
+
+    GnuplotPipe& gp = *w->pipe;
+    gp.sendLine("unset multiplot");
+    gp.sendLine("reset");
+    gp.sendLine("cd calc_pool_home");
+    gp.sendLine("chosen_term = '"+term+"'");
+    for (int i = 0; i < gnuplot_terms.size(); i++) gp.sendLine(gnuplot_terms.at(i));
+    w->term = term;
+    gp.sendLine("eval calc_styles");
+    return w;
+  }
+
+  // blocks until the worker has executed every command sent so far: it
+  // prints a token to its stdout once it gets to the end of the queue. other
+  // lines gnuplot writes to stdout are passed on
+  void sync(Worker* w) {
+    if (w->broken) return;
+    if (!alive(w)) {
+      std::cout << "gnuplot pool: worker " << w->id << " has exited" << std::endl;
+      w->broken = true;
+      return;
+    }
+    std::string token = "calc_sync "+std::to_string(++w->syncs);
+    w->pipe->sendLine("set print '-'");
+    w->pipe->sendLine("print '"+token+"'");
+    w->pipe->sendLine("unset print");
+    w->pipe->flush();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    while (true) {
+      for (size_t eol; (eol = w->received.find('\n')) != std::string::npos; ) {
+        std::string line = w->received.substr(0, eol);
+        w->received.erase(0, eol+1);
+        if (line == token) return;
+        std::cout << line << std::endl;
+      }
+      double left = sync_timeout - std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+      if (left <= 0.) {
+        std::cout << "gnuplot pool: worker " << w->id << " did not respond within " << sync_timeout << "s, retiring it" << std::endl;
+        w->broken = true;
+        return;
+      }
+      struct pollfd ready = { w->reply, POLLIN, 0 };
+      if (poll(&ready, 1, (int) std::ceil(left*1000.)) <= 0) continue;
+      char chunk[512];
+      ssize_t n = read(w->reply, chunk, sizeof(chunk));
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) {
+        std::cout << "gnuplot pool: worker " << w->id << " exited before finishing" << std::endl;
+        w->broken = true;
+        return;
+      }
+      w->received.append(chunk, n);
+    }
+  }
+
+  void release(Worker* w) {
+    if (!w->broken) {
+      w->pipe->sendLine("unset output");
+      w->pipe->flush();
+    }
+    sigset_t caller_mask = w->caller_mask;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      w->busy = false;
+      if (w->broken) {
+        for (int i = 0; i < workers.size(); i++) if (workers.at(i) == w) workers.erase(workers.begin() + i);
+      }
+      released.notify_one();
+    }
+    if (w->broken) retire(w);
+    drop_sigpipe();
+    pthread_sigmask(SIG_SETMASK, &caller_mask, NULL);
+  }
+
+private:
+  std::vector<Worker*> workers;
+  std::mutex mutex;
+  std::condition_variable released;
+  int spawned = 0;
+
+  GnuplotPool() { }
+  GnuplotPool(GnuplotPool const&) = delete;
+  void operator=(GnuplotPool const&) = delete;
+
+  static int limit() {
+    if (max_workers > 0) return max_workers;
+    int n = std::thread::hardware_concurrency();
+    return (n < 1) ? 1 : n;
+  }
+
+  // false once the process has exited; reaps it
+  static bool alive(Worker* w) {
+    if (w->pid > 0 && waitpid(w->pid, NULL, WNOHANG) == w->pid) w->pid = -1;
+    return w->pid > 0;
+  }
+
+  static sigset_t sigpipe() {
+    sigset_t pipe_signal;
+    sigemptyset(&pipe_signal);
+    sigaddset(&pipe_signal, SIGPIPE);
+    return pipe_signal;
+  }
+
+  // consumes the SIGPIPE raised by writes to a dead process while it was
+  // blocked; the writes themselves failed with EPIPE
+  static void drop_sigpipe() {
+    sigset_t pipe_signal = sigpipe();
+    struct timespec no_wait = { 0, 0 };
+    while (sigtimedwait(&pipe_signal, NULL, &no_wait) > 0) { }
+  }
+
+  template <typename Write>
+  static void without_sigpipe(Write write) {
+    sigset_t pipe_signal = sigpipe(), previous;
+    pthread_sigmask(SIG_BLOCK, &pipe_signal, &previous);
+    write();
+    drop_sigpipe();
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+  }
+
+  // kills the process and frees the worker, dropping what is still buffered
+  static void retire(Worker* w) {
+    if (w->pid > 0) {
+      kill(w->pid, SIGKILL);
+      waitpid(w->pid, NULL, 0);
+    }
+    without_sigpipe([w]{ delete w->pipe; });
+    if (w->reply >= 0) close(w->reply);
+    delete w;
+  }
+
+  // command run by /bin/sh with its stdin and stdout on pipes of ours; the
+  // pipe ends are close-on-exec, so other workers do not inherit them. a
+  // worker that cannot be started is broken from the start and ignores
+  // everything sent to it
+  Worker* spawn() {
+    Worker* w = new Worker();
+    w->pid = -1;
+    w->reply = -1;
+    w->syncs = 0;
+    w->busy = false;
+    w->broken = false;
+    w->id = spawned++;
+    int in[2], out[2];
+    if (pipe(in) != 0) in[0] = in[1] = -1;
+    if (pipe(out) != 0) out[0] = out[1] = -1;
+    int ends[4] = { in[0], in[1], out[0], out[1] };
+    for (int e = 0; e < 4; e++) if (ends[e] >= 0) fcntl(ends[e], F_SETFD, FD_CLOEXEC);
+    if (in[0] >= 0 && out[0] >= 0) w->pid = fork();
+    if (w->pid == 0) {
+      dup2(in[0], 0);
+      dup2(out[1], 1);
+      execl("/bin/sh", "sh", "-c", command.c_str(), (char*) NULL);
+      _exit(127);
+    }
+    if (in[0] >= 0) close(in[0]);
+    if (out[1] >= 0) close(out[1]);
+    if (w->pid < 0) {
+      std::cout << "gnuplot pool: starting " << command << " failed" << std::endl;
+      if (in[1] >= 0) close(in[1]);
+      if (out[0] >= 0) close(out[0]);
+      w->pipe = new GnuplotPipe(nullptr);
+      w->broken = true;
+    }
+    else {
+      w->pipe = new GnuplotPipe(fdopen(in[1], "w"));
+      w->reply = out[0];
+    }
+    GnuplotPipe& gp = *w->pipe;
+    gp.sendLine("calc_pool_home = GPVAL_PWD");
+    std::string styles;
+    for (int i = 0; i < gnuplot_styles.size(); i++) {
+      const std::string& line = gnuplot_styles.at(i);
+      if (line.empty() || line[0] == '#') continue;
+      styles += line + "; ";
+    }
+    gp.sendLine("calc_styles = \"" + styles + "\"");
+    workers.push_back(w);
+    return w;
+  }
+};
+
+std::string GnuplotPool::command = "gnuplot";
+int GnuplotPool::max_workers = 0;
+double GnuplotPool::sync_timeout = 30.;
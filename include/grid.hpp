@@ -0,0 +1,183 @@
+#ifndef GRID_H
+#define GRID_H
+
+#include <vector>
+#include <complex>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+
+/*
+ random-access point generators: point i is computed on demand, so an axis
+ costs no memory and any index can be reached without walking the others.
+ complex grids follow linspace/logspace: num_real x num_imag points with the
+ imaginary part running fastest.
+*/
+class Grid {
+public:
+  virtual ~Grid() { }
+  virtual size_t size() const = 0;
+  virtual std::complex<double> at(size_t i) const = 0;
+
+  virtual std::vector<std::complex<double> > materialise() const {
+    std::vector<std::complex<double> > points(size());
+    for (size_t i = 0; i < points.size(); i++) points[i] = at(i);
+    return points;
+  }
+};
+
+class LinearGrid: public Grid {
+public:
+  LinearGrid(std::complex<double> start, std::complex<double> end, int num_real, int num_imag = 1)
+  : start(start), end(end), num_real(num_real < 0 ? 0 : num_real), num_imag(num_imag < 0 ? 0 : num_imag)
+  {
+    step_real = (end.real()-start.real())/(double) ((num_real < 2) ? 1 : num_real-1);
+    step_imag = (end.imag()-start.imag())/(double) ((num_imag < 2) ? 1 : num_imag-1);
+  }
+
+  size_t size() const { return (size_t) num_real*num_imag; }
+
+  std::complex<double> at(size_t i) const {
+    size_t r = i / num_imag, m = i % num_imag;
+    return std::complex<double>(start.real() + (double) r*step_real, start.imag() + (double) m*step_imag);
+  }
+
+private:
+  std::complex<double> start, end;
+  int num_real, num_imag;
+  double step_real, step_imag;
+};
+
+// powers of ten evenly spaced in the exponent, separately for each part. a
+// single imaginary point with a zero imaginary start gives real points.
+class LogGrid: public Grid {
+public:
+  LogGrid(std::complex<double> start, std::complex<double> end, int num_real, int num_imag = 1)
+  : exponents(std::complex<double>(log10(start.real()), log10(start.imag())),
+      std::complex<double>(log10(end.real()), log10(end.imag())), num_real, num_imag),
+    num_imag(num_imag < 0 ? 0 : num_imag),
+    real_only(num_imag == 1 && start.imag() == 0.0)
+  { }
+
+  size_t size() const { return exponents.size(); }
+
+  std::complex<double> at(size_t i) const {
+    std::complex<double> e = exponents.at(i);
+    return std::complex<double>(std::pow(10., e.real()), real_only ? 0.0 : std::pow(10., e.imag()));
+  }
+
+  // one pow per axis point instead of two per grid point
+  std::vector<std::complex<double> > materialise() const {
+    size_t num_real = (num_imag == 0) ? 0 : size()/num_imag;
+    std::vector<double> re(num_real), im(num_imag);
+    for (size_t r = 0; r < num_real; r++) re[r] = std::pow(10., exponents.at(r*num_imag).real());
+    for (size_t m = 0; m < num_imag; m++) im[m] = real_only ? 0.0 : std::pow(10., exponents.at(m).imag());
+    std::vector<std::complex<double> > points;
+    points.reserve(size());
+    for (size_t r = 0; r < num_real; r++)
+      for (size_t m = 0; m < num_imag; m++) points.push_back(std::complex<double>(re[r], im[m]));
+    return points;
+  }
+
+private:
+  LinearGrid exponents;
+  size_t num_imag;
+  bool real_only;
+};
+
+// Chebyshev nodes of the segment start -> end, in order from start to end;
+// they cluster towards both ends
+class ChebyshevGrid: public Grid {
+public:
+  ChebyshevGrid(std::complex<double> start, std::complex<double> end, int num)
+  : start(start), end(end), num(num < 0 ? 0 : num)
+  { }
+
+  size_t size() const { return num; }
+
+  std::complex<double> at(size_t i) const {
+    double x = -std::cos(M_PI*(2.*i + 1.)/(2.*num)); // -1 .. 1
+    return start + (end-start)*((x + 1.)/2.);
+  }
+
+private:
+  std::complex<double> start, end;
+  size_t num;
+};
+
+// num points map(t) for t evenly spaced over [0,1]
+class MappedGrid: public Grid {
+public:
+  MappedGrid(int num, std::function<std::complex<double>(double)> map)
+  : num(num < 0 ? 0 : num), map(map)
+  { }
+
+  size_t size() const { return num; }
+
+  std::complex<double> at(size_t i) const {
+    return map((num < 2) ? 0. : (double) i/(num-1));
+  }
+
+private:
+  size_t num;
+  std::function<std::complex<double>(double)> map;
+};
+
+/*
+ position in the Cartesian product of axes of the given sizes, last axis
+ fastest: the order of the nested loops of a sweep. the flat index can be
+ sought directly, so a sweep can start anywhere (a shard, a resumed run, a
+ vector block) without walking the points before it.
+*/
+class ProductIndex {
+public:
+  ProductIndex(const std::vector<size_t>& shape, size_t flat = 0)
+  : shape(shape), coordinates(shape.size())
+  {
+    count = 1;
+    for (size_t d = 0; d < shape.size(); d++) count *= shape[d];
+    seek(flat);
+  }
+
+  size_t flat() const { return position; }
+  size_t total() const { return count; }
+  bool done() const { return position >= count; }
+  size_t operator[](int d) const { return coordinates[d]; }
+  const std::vector<size_t>& coords() const { return coordinates; }
+
+  void seek(size_t flat) {
+    position = flat;
+    decode(shape, flat, coordinates);
+  }
+
+  // steps to the next flat index and returns the outermost axis whose
+  // coordinate changed; axes from there inwards need new values
+  int next() {
+    position++;
+    return increment(shape, coordinates);
+  }
+
+  static void decode(const std::vector<size_t>& shape, size_t flat, std::vector<size_t>& coords) {
+    for (int d = shape.size()-1; d >= 0; d--) {
+      coords[d] = (shape[d] == 0) ? 0 : flat % shape[d];
+      if (shape[d] != 0) flat /= shape[d];
+    }
+  }
+
+  static int increment(const std::vector<size_t>& shape, std::vector<size_t>& coords) {
+    int d = shape.size()-1;
+    for (; d >= 0; d--) {
+      if (++coords[d] < shape[d]) break;
+      coords[d] = 0;
+    }
+    return (d < 0) ? 0 : d;
+  }
+
+private:
+  std::vector<size_t> shape;
+  std::vector<size_t> coordinates;
+  size_t count;
+  size_t position;
+};
+
+#endif // GRID_H
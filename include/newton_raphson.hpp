@@ -6,8 +6,16 @@
 #include <iomanip>
 #include <complex>
 #include <fstream>
+#include <mutex>
+#include <map>
+#include <memory>
 #include <calc_util.hpp>
 #include <plot_script.hpp>
+#include <thread_pool.hpp>
+#include <dual.hpp>
+#include <data_file.hpp>
+#include <algorithm>
+#include <type_traits>
 
 #define NR_NULL 0
 #define NR_SUCCESS 1
@@ -21,7 +29,50 @@ public:
   static double num_diff_step;
   static bool print_warnings;
   static bool record_history;
+  static int threads;
+  static int landscape_resolution;
 
+  // preallocated history storage, sized from 'iterations' and reused by every
+  // solve on the same thread, so the iteration loop never allocates. when it
+  // is full the oldest iterations are overwritten.
+  class workspace {
+  public:
+    void prepare(int n) {
+      if (n < 1) n = 1;
+      if (n > capacity) {
+        capacity = n;
+        mod_f.resize(n); mod_df.resize(n); z.resize(n);
+      }
+      start = count = 0;
+    }
+
+    void record(std::complex<double> z_i, double mod_f_i, double mod_df_i) {
+      int slot = (start + count) % capacity;
+      z[slot] = z_i; mod_f[slot] = mod_f_i; mod_df[slot] = mod_df_i;
+      if (count < capacity) count++;
+      else start = (start+1) % capacity;
+    }
+
+    // the recorded iterations, oldest first, into the vectors of a result
+    template <typename Result>
+    void copy_to(Result& r) const {
+      unwrap(mod_f, r.history_mod_f);
+      unwrap(mod_df, r.history_mod_df);
+      unwrap(z, r.history_z);
+    }
+
+  private:
+    std::vector<double> mod_f, mod_df;
+    std::vector<std::complex<double> > z;
+    int capacity = 0, start = 0, count = 0;
+
+    template <typename T> void unwrap(const std::vector<T>& ring, std::vector<T>& out) const {
+      out.resize(count);
+      for (int i = 0; i < count; i++) out[i] = ring[(start+i) % capacity];
+    }
+  };
+
+  // a result owns its history, so it stays valid after further solves
   struct result {
     int status;
     std::complex<double> z;
@@ -32,57 +83,100 @@ public:
     std::complex<double>(*f_zero)(std::complex<double>);
   };
 
+  // per guess outcome of solve_batch. reuse one instance across calls: the
+  // vectors only grow, so repeated batches do not allocate.
+  struct batch_result {
+    std::vector<int> status;
+    std::vector<std::complex<double> > z;
+    std::vector<int> iterations;
+  };
+
+  // evaluates f at n points in split layout: f_re[i] + i f_im[i] = f(re[i] + i im[i])
+  typedef void (*batch_function)(const double* re, const double* im, double* f_re, double* f_im, size_t n);
+
   NewtonRaphson() { }
 
   
   result solve(std::complex<double>(*f_zero)(std::complex<double>), std::complex<double> guess_z, double epsabs, double epsrel) {
-    std::complex<double> z(guess_z);
-    std::complex<double> f;
-    std::complex<double> df;
-    
-    result r; r.status = NR_NULL;
-    int i; 
-    for (i = 0; i < iterations; i++) {
-      f = f_zero(z); 
+    result r = iterate([&](std::complex<double> z, std::complex<double>& f, std::complex<double>& df) {
+      f = f_zero(z);
       df = num_diff(f_zero, z);
-      if (record_history) {
-        r.history_z.push_back(z);
-        r.history_mod_f.push_back(abs(f));
-        r.history_mod_df.push_back(abs(df));
-      }
-
-      if (abs(f/df) < epsabs + epsrel*abs(z)) {
-        r.status = NR_SUCCESS;  
-        break;
-      }
-      if (abs(df) == 0.0) {
-        print_warn("df is zero at "+to_string(z)+ " at iteration "+to_string(i));
-        r.status = NR_NAUGHTY;
-        break;
-      }
-      if (!std::isfinite(abs(f))) {
-        print_warn("f is badly behaved (Inf or NaN) at "+to_string(z) + " at iteration "+to_string(i));
-        r.status = NR_NAUGHTY;
-        break;
-      }
-
-      z = z - f/df;
-    }  
-    r.iterations = i+1;
-    r.z = z;
+    }, guess_z, epsabs, epsrel);
     r.f_zero = f_zero;
+    return r;
+  }
+
+  // any callable. when its signature accepts Dual numbers (a template or a
+  // generic lambda) f and the exact f' come from one forward-mode AD pass,
+  // otherwise (e.g. a lambda taking std::complex<double>) f' is the central
+  // difference of the plain solve(). only the signature is tested: a generic
+  // lambda is always evaluated on Dual, so its body has to call the maths
+  // functions unqualified (exp(z), not std::exp(z)), or it does not compile.
+  template <typename F>
+  result solve(F f_zero, std::complex<double> guess_z, double epsabs, double epsrel) {
+    result r;
+    if constexpr (std::is_invocable<F, Dual<std::complex<double> > >::value) {
+      r = iterate([&](std::complex<double> z, std::complex<double>& f, std::complex<double>& df) {
+        Dual<std::complex<double> > fz = f_zero(Dual<std::complex<double> >(z, 1.));
+        f = fz.v;
+        df = fz.d;
+      }, guess_z, epsabs, epsrel);
+    } else {
+      r = iterate([&](std::complex<double> z, std::complex<double>& f, std::complex<double>& df) {
+        f = f_zero(z);
+        df = (f_zero(z+num_diff_step/2.) - f_zero(z-num_diff_step/2.))/num_diff_step;
+      }, guess_z, epsabs, epsrel);
+    }
+    r.f_zero = function_pointer(f_zero);
+    return r;
+  }
 
+  // user supplied analytic derivative df_zero = f_zero'
+  template <typename F, typename DF>
+  result solve(F f_zero, DF df_zero, std::complex<double> guess_z, double epsabs, double epsrel) {
+    result r = iterate([&](std::complex<double> z, std::complex<double>& f, std::complex<double>& df) {
+      f = f_zero(z);
+      df = df_zero(z);
+    }, guess_z, epsabs, epsrel);
+    r.f_zero = function_pointer(f_zero);
     return r;
   }
 
+  // solves from every guess at once. guesses are iterated together in split
+  // layout, converged lanes are dropped from the active set after each step,
+  // and blocks of batch_block guesses are spread over 'threads' workers.
+  void solve_batch(batch_function f_zero, const std::complex<double>* guesses, size_t n,
+    double epsabs, double epsrel, batch_result& out)
+  {
+    prepare_batch(out, n);
+    run_blocks(n, [&](size_t begin, size_t end) {
+      solve_block(f_zero, guesses, begin, end, epsabs, epsrel, out);
+    });
+  }
+
+  // same with an ordinary scalar function, evaluated lane by lane
+  void solve_batch(std::complex<double>(*f_zero)(std::complex<double>), const std::complex<double>* guesses, size_t n,
+    double epsabs, double epsrel, batch_result& out)
+  {
+    prepare_batch(out, n);
+    auto lanes = [f_zero](const double* re, const double* im, double* f_re, double* f_im, size_t m) {
+      for (size_t i = 0; i < m; i++) {
+        std::complex<double> f = f_zero(std::complex<double>(re[i], im[i]));
+        f_re[i] = f.real(); f_im[i] = f.imag();
+      }
+    };
+    run_blocks(n, [&](size_t begin, size_t end) {
+      solve_block(lanes, guesses, begin, end, epsabs, epsrel, out);
+    });
+  }
 
-  void analyze(result r, std::string analysis_name, int skip_iterations = 0) {
+  void analyze(const result& r, std::string analysis_name, int skip_iterations = 0) {
     std::cout << analysis_name << "\n" << "-----------------------------" << "\n" << "iteratations: " << r.iterations << std::endl;
     calc_util::mkdir(analysis_name+"/");
     std::ofstream outfile;
     outfile.open(analysis_name+"/"+"history.data");
     double max_real = -1e300, min_real = 1e300, max_imag = -1e300, min_imag = 1e300;
-    for (int i=0; i < r.iterations; i++) {
+    for (int i=0; i < r.history_z.size(); i++) {
       outfile << r.history_mod_f.at(i) << "," 
         << r.history_mod_df.at(i) << "," 
         << r.history_mod_f.at(i)/r.history_mod_df.at(i) << ","
@@ -124,45 +218,263 @@ public:
     " 'history.data' u 5:6 w l title 'evolution'");
     ps2.end();
 
-    outfile.open(analysis_name+"/"+"f_zero.data");
-    double min_f=1e300, max_f=-1e300;
-    double abs_f;
-    for (double re = min_real; re <= max_real; re += (max_real-min_real)/10.) {
-      for (double im = min_imag; im <= max_imag; im += (max_imag-min_imag)/10.) {
-        abs_f = abs(r.f_zero(std::complex<double>(re,im)));
-        outfile << re << "," << im << "," << abs_f << "\n";
-        if (min_f > abs_f) min_f = abs_f;
-        if (max_f < abs_f) max_f = abs_f;
+    if (r.f_zero == NULL) return;
+    // the landscape is framed by the trajectory, so there is none without it
+    if (r.history_z.empty()) {
+      std::cout << analysis_name << ": no history recorded, landscape skipped" << std::endl;
+      return;
+    }
+    // progressive landscape: a coarse preview of the whole trajectory first,
+    // then full resolution around the last iterations
+    double margin_re = (max_real-min_real)*0.1, margin_im = (max_imag-min_imag)*0.1;
+    double span = std::max(max_real-min_real, max_imag-min_imag);
+    if (span == 0.0) span = std::max(abs(r.z), 1.0)*1e-3;
+    if (margin_re == 0.0) margin_re = span/2.;
+    if (margin_im == 0.0) margin_im = span/2.;
+    landscape coarse = { min_real-margin_re, max_real+margin_re, min_imag-margin_im, max_imag+margin_im,
+      std::max(landscape_resolution/4, 11), std::max(landscape_resolution/4, 11), 1e300, -1e300 };
+    evaluate_landscape(r.f_zero, coarse, analysis_name+"/"+"f_zero_coarse.data");
+    plot_landscape(analysis_name, "function_preview", coarse, coarse, false);
+
+    int tail = std::min((int) r.history_z.size(), 5);
+    double d_re0 = 1e300, d_re1 = -1e300, d_im0 = 1e300, d_im1 = -1e300;
+    for (int i = r.history_z.size()-tail; i < r.history_z.size(); i++) {
+      d_re0 = std::min(d_re0, r.history_z.at(i).real()); d_re1 = std::max(d_re1, r.history_z.at(i).real());
+      d_im0 = std::min(d_im0, r.history_z.at(i).imag()); d_im1 = std::max(d_im1, r.history_z.at(i).imag());
+    }
+    double half = std::max(std::max(d_re1-d_re0, d_im1-d_im0), span/16.)/2.*1.2;
+    double c_re = (d_re0+d_re1)/2., c_im = (d_im0+d_im1)/2.;
+    landscape detail = { c_re-half, c_re+half, c_im-half, c_im+half,
+      landscape_resolution, landscape_resolution, 1e300, -1e300 };
+    evaluate_landscape(r.f_zero, detail, analysis_name+"/"+"f_zero.data");
+    plot_landscape(analysis_name, "function", coarse, detail, true);
+  }
+
+protected:
+private:
+
+  std::string to_string(const std::complex<double>& z) {
+    std::stringstream ss;
+    ss << std::setprecision (4) << z.real();
+    if (z.imag() != 0.0) ss  << " + " << z.imag() << "i ";
+    return ss.str();
+  }
+
+  // |f_zero| sampled on a regular re x im grid, re outermost
+  struct landscape {
+    double re0, re1, im0, im1;
+    int num_re, num_im;
+    double min_f, max_f;
+  };
+
+  // evaluates the grid in square tiles on the batch pool and writes it as a
+  // binary data file (re, im, |f|) that gnuplot reads with 'record='
+  void evaluate_landscape(std::complex<double>(*f_zero)(std::complex<double>),
+    landscape& l, std::string filepath)
+  {
+    const int tile = 32;
+    int tiles_re = (l.num_re + tile-1)/tile, tiles_im = (l.num_im + tile-1)/tile;
+    std::vector<double> values((size_t) l.num_re*l.num_im);
+    ThreadPool::RangeFunction compute = [&](size_t begin, size_t end, int) {
+      for (size_t t = begin; t < end; t++) {
+        int r0 = (t / tiles_im)*tile, i0 = (t % tiles_im)*tile;
+        for (int a = r0; a < std::min(r0+tile, l.num_re); a++)
+          for (int b = i0; b < std::min(i0+tile, l.num_im); b++)
+            values[(size_t) a*l.num_im + b] = abs(f_zero(landscape_point(l, a, b)));
+      }
+    };
+    ThreadPool* pool = batch_pool();
+    if (pool) pool->parallel_for(tiles_re*tiles_im, 1, compute);
+    else compute(0, tiles_re*tiles_im, 0);
+
+    std::vector<std::string> headers = {"re", "im", "abs_f"};
+    std::vector<size_t> shape = {(size_t) l.num_re, (size_t) l.num_im};
+    BinaryDataWriter writer(filepath, headers, shape);
+    for (int a = 0; a < l.num_re; a++) {
+      for (int b = 0; b < l.num_im; b++) {
+        std::complex<double> z = landscape_point(l, a, b);
+        double row[3] = { z.real(), z.imag(), values[(size_t) a*l.num_im + b] };
+        writer.write_row(row, 3);
+        if (std::isfinite(row[2])) { l.min_f = std::min(l.min_f, row[2]); l.max_f = std::max(l.max_f, row[2]); }
       }
     }
-    outfile.flush(); outfile.close();
-    
-    
-    PlotScript ps3("function","png");
+    writer.close();
+  }
+
+  static std::complex<double> landscape_point(const landscape& l, int a, int b) {
+    return std::complex<double>(l.re0 + (l.re1-l.re0)*a/std::max(l.num_re-1, 1),
+      l.im0 + (l.im1-l.im0)*b/std::max(l.num_im-1, 1));
+  }
+
+  std::string landscape_source(std::string filename, const landscape& l) {
+    BinaryDataReader reader(filename);
+    return "'"+filename.substr(filename.rfind('/')+1)+"' "+reader.gnuplot_binary_spec()
+      +" record="+std::to_string(l.num_im)+"x"+std::to_string(l.num_re)+" u 1:2:3 with image notitle";
+  }
+
+  void plot_landscape(std::string analysis_name, std::string output,
+    const landscape& coarse, const landscape& detail, bool with_detail)
+  {
+    double min_f = std::min(coarse.min_f, detail.min_f), max_f = std::max(coarse.max_f, detail.max_f);
+    PlotScript ps3(output,"png");
     ps3.r("set xtics font 'Courier,17'");
     ps3.r("set ytics font 'Courier,17'");
     ps3.r("set label font 'Courier,17'");
-    ps3.set_separator(",");
     ps3.r("cd '"+analysis_name+"/'");
-    ps3.set_output("function");
+    ps3.set_output(output);
     ps3.r("unset title");
     ps3.r("set view map");
     ps3.r("set xtics norotate");
     ps3.r("set palette rgbformulae 10,13,33");
     ps3.r("set cbrange ["+to_string(min_f)+":"+to_string(max_f)+"]");
-    ps3.r("splot 'f_zero.data' u 1:2:3 with image");
+    std::string splot = "splot "+landscape_source(analysis_name+"/f_zero_coarse.data", coarse);
+    if (with_detail) splot += ", "+landscape_source(analysis_name+"/f_zero.data", detail);
+    ps3.r(splot);
     ps3.end();
+  }
+
+  // the Newton loop; eval(z, f, df) sets f(z) and f'(z)
+  template <typename Eval>
+  result iterate(Eval eval, std::complex<double> guess_z, double epsabs, double epsrel) {
+    std::complex<double> z(guess_z);
+    std::complex<double> f;
+    std::complex<double> df;
+    
+    result r; r.status = NR_NULL;
+    // per thread, so solves of one NewtonRaphson can run in parallel
+    static thread_local workspace history;
+    if (record_history) history.prepare(iterations);
+    int i; 
+    for (i = 0; i < iterations; i++) {
+      eval(z, f, df);
+      if (record_history) history.record(z, abs(f), abs(df));
+
+      if (abs(f/df) < epsabs + epsrel*abs(z)) {
+        r.status = NR_SUCCESS;  
+        break;
+      }
+      if (abs(df) == 0.0) {
+        if (print_warnings) print_warn("df is zero at "+to_string(z)+ " at iteration "+to_string(i));
+        r.status = NR_NAUGHTY;
+        break;
+      }
+      if (!std::isfinite(abs(f))) {
+        if (print_warnings) print_warn("f is badly behaved (Inf or NaN) at "+to_string(z) + " at iteration "+to_string(i));
+        r.status = NR_NAUGHTY;
+        break;
+      }
+
+      z = z - f/df;
+    }  
+    r.iterations = i+1;
+    r.z = z;
+    r.f_zero = NULL;
+    if (record_history) history.copy_to(r);
 
+    return r;
   }
 
-protected:
-private:
+  // analyze() needs a plain function to sample the landscape
+  template <typename F>
+  static std::complex<double>(*function_pointer(F f))(std::complex<double>) {
+    if constexpr (std::is_convertible<F, std::complex<double>(*)(std::complex<double>)>::value)
+      return f;
+    else
+      return NULL;
+  }
 
-  std::string to_string(const std::complex<double>& z) {
-    std::stringstream ss;
-    ss << std::setprecision (4) << z.real();
-    if (z.imag() != 0.0) ss  << " + " << z.imag() << "i ";
-    return ss.str();
+  static const size_t batch_block = 256;
+
+  static void prepare_batch(batch_result& out, size_t n) {
+    if (out.status.size() < n) {
+      out.status.resize(n);
+      out.z.resize(n);
+      out.iterations.resize(n);
+    }
+  }
+
+  template <typename Body>
+  void run_blocks(size_t n, Body body) {
+    ThreadPool* pool = batch_pool();
+    if (pool == NULL || n <= batch_block) {
+      for (size_t b = 0; b < n; b += batch_block) body(b, (b+batch_block < n) ? b+batch_block : n);
+      return;
+    }
+    pool->parallel_for(n, batch_block, [&](size_t begin, size_t end, int) { body(begin, end); });
+  }
+
+  // shared by every NewtonRaphson, one per thread count. a pool is kept
+  // until exit, so changing 'threads' never frees a pool that another
+  // solver is still running on
+  static ThreadPool* batch_pool() {
+    static std::mutex pool_mutex;
+    static std::map<int, std::unique_ptr<ThreadPool> > pools;
+    int wanted = (threads < 1) ? ThreadPool::hardware_threads() : threads;
+    if (wanted == 1) return NULL;
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    std::unique_ptr<ThreadPool>& pool = pools[wanted];
+    if (!pool) pool.reset(new ThreadPool(wanted));
+    return pool.get();
+  }
+
+  // Newton iteration of guesses [begin,end) with the same tests and status
+  // codes as solve(). the active lanes are kept packed at the front of the
+  // split arrays, lane_index maps them back to their guess.
+  template <typename Eval>
+  void solve_block(Eval f_zero, const std::complex<double>* guesses, size_t begin, size_t end,
+    double epsabs, double epsrel, batch_result& out)
+  {
+    static thread_local std::vector<double> ws;
+    static thread_local std::vector<size_t> lane_index;
+    size_t m = end - begin;
+    if (ws.size() < 9*m) ws.resize(9*m);
+    if (lane_index.size() < m) lane_index.resize(m);
+    double *zr = &ws[0], *zi = &ws[m], *fr = &ws[2*m], *fi = &ws[3*m];
+    double *sr = &ws[4*m], *pr = &ws[5*m], *pi = &ws[6*m], *mr = &ws[7*m], *mi = &ws[8*m];
+
+    for (size_t k = 0; k < m; k++) {
+      zr[k] = guesses[begin+k].real();
+      zi[k] = guesses[begin+k].imag();
+      lane_index[k] = begin+k;
+    }
+    size_t active = m;
+    int i;
+    for (i = 0; i < iterations && active > 0; i++) {
+      f_zero(zr, zi, fr, fi, active);
+      // central difference along the real axis, as num_diff
+      for (size_t k = 0; k < active; k++) sr[k] = zr[k] + num_diff_step/2.;
+      f_zero(sr, zi, pr, pi, active);
+      for (size_t k = 0; k < active; k++) sr[k] = zr[k] - num_diff_step/2.;
+      f_zero(sr, zi, mr, mi, active);
+
+      size_t kept = 0;
+      for (size_t k = 0; k < active; k++) {
+        std::complex<double> z(zr[k], zi[k]);
+        std::complex<double> f(fr[k], fi[k]);
+        std::complex<double> df((pr[k]-mr[k])/num_diff_step, (pi[k]-mi[k])/num_diff_step);
+        size_t g = lane_index[k];
+        int status = NR_NULL;
+        if (abs(f/df) < epsabs + epsrel*abs(z)) status = NR_SUCCESS;
+        else if (abs(df) == 0.0 || !std::isfinite(abs(f))) status = NR_NAUGHTY;
+        if (status != NR_NULL) {
+          out.status[g] = status;
+          out.z[g] = z;
+          out.iterations[g] = i+1;
+          continue;
+        }
+        z = z - f/df;
+        zr[kept] = z.real(); zi[kept] = z.imag();
+        lane_index[kept] = g;
+        kept++;
+      }
+      active = kept;
+    }
+    for (size_t k = 0; k < active; k++) {
+      size_t g = lane_index[k];
+      out.status[g] = NR_NULL;
+      out.z[g] = std::complex<double>(zr[k], zi[k]);
+      out.iterations[g] = i+1;
+    }
   }
 
   void print_warn(std::string warn) { if(print_warnings) std::cout << "nr: warning: " << warn << std::endl; }
@@ -176,6 +488,8 @@ private:
 int NewtonRaphson::iterations = 50;
 bool NewtonRaphson::print_warnings = false;
 bool NewtonRaphson::record_history = false;
+int NewtonRaphson::threads = 1;
+int NewtonRaphson::landscape_resolution = 201;
 double NewtonRaphson::num_diff_step = 1.0e-6;
 
 
@@ -0,0 +1,72 @@
+#ifndef PHILOX_H
+#define PHILOX_H
+
+#include <array>
+#include <cstdint>
+
+/*
+ Philox4x32-10, the counter-based generator of Salmon et al., "Parallel
+ random numbers: as easy as 1, 2, 3" (SC11). the four 32 bit output words
+ are a bijection of a 128 bit counter under a 64 bit key, so draw n of any
+ stream is computed from (key, counter) alone: no state is shared between
+ threads and nothing has to be skipped ahead.
+*/
+class Philox {
+public:
+  typedef std::array<uint32_t, 4> Block;
+
+  Philox(uint64_t seed = 0): key{ (uint32_t) seed, (uint32_t) (seed >> 32) } { }
+
+  // the block of counter (c0, c1), each word pair low word first
+  Block operator()(uint64_t c0, uint64_t c1) const {
+    Block c = { (uint32_t) c0, (uint32_t) (c0 >> 32), (uint32_t) c1, (uint32_t) (c1 >> 32) };
+    uint32_t k0 = key[0], k1 = key[1];
+    for (int r = 0; r < 10; r++) {
+      uint64_t p0 = (uint64_t) 0xD2511F53 * c[0], p1 = (uint64_t) 0xCD9E8D57 * c[2];
+      c = { (uint32_t) (p1 >> 32) ^ c[1] ^ k0, (uint32_t) p1, (uint32_t) (p0 >> 32) ^ c[3] ^ k1, (uint32_t) p0 };
+      k0 += 0x9E3779B9;
+      k1 += 0xBB67AE85;
+    }
+    return c;
+  }
+
+  // two uniform doubles in [0,1) per block: half k = 0 or 1
+  double uniform(uint64_t c0, uint64_t c1, int k) const {
+    Block b = (*this)(c0, c1);
+    return to_unit(b[2*k], b[2*k+1]);
+  }
+
+  // 53 random bits from two words
+  static double to_unit(uint32_t hi, uint32_t lo) {
+    return (double) ((((uint64_t) hi << 32) | lo) >> 11) * (1.0/9007199254740992.0);
+  }
+
+private:
+  uint32_t key[2];
+};
+
+// sequential draws from stream 'stream' of a key: block n of the stream is
+// counter (n, stream)
+class PhiloxStream {
+public:
+  PhiloxStream(uint64_t seed, uint64_t stream): philox(seed), stream(stream) { }
+
+  uint32_t next() {
+    if (used == 4) { block = philox(counter++, stream); used = 0; }
+    return block[used++];
+  }
+
+  double uniform() {
+    uint32_t hi = next();
+    return Philox::to_unit(hi, next());
+  }
+
+private:
+  Philox philox;
+  uint64_t stream;
+  uint64_t counter = 0;
+  Philox::Block block;
+  int used = 4;
+};
+
+#endif // PHILOX_H
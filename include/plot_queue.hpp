@@ -0,0 +1,163 @@
+#ifndef PLOT_QUEUE_H
+#define PLOT_QUEUE_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <chrono>
+#include <memory>
+#include <atomic>
+
+#include "gnuplot/gnuplot_pool.hpp"
+
+/*
+ renders plots in the background. a job starts once every future it was
+ submitted 'after' is ready, e.g. the sweep that writes its data file, so
+ independent plots run side by side on the gnuplot processes of the pool
+ (set PlotScript::pooled). idle workers sleep until a job is submitted or
+ finishes, or until a dependency that completes outside the queue is ready,
+ which a thread blocked on that future reports. errors thrown by a job are
+ delivered through its future. the queue drains before it is destroyed at
+ exit.
+*/
+class PlotQueue {
+public:
+  static int threads; // 0: one per hardware thread
+
+  static PlotQueue& shared() {
+    static PlotQueue queue;
+    return queue;
+  }
+
+  ~PlotQueue() {
+    wait_all();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    changed.notify_all();
+    for (int i = 0; i < workers.size(); i++) workers.at(i).join();
+    std::lock_guard<std::mutex> lock(watchers_mutex);
+    for (int i = 0; i < watchers.size(); i++) watchers.at(i).thread.join();
+  }
+
+  std::shared_future<void> submit(std::function<void()> job,
+    std::vector< std::shared_future<void> > after = std::vector< std::shared_future<void> >())
+  {
+    std::shared_ptr< std::promise<void> > done(new std::promise<void>());
+    std::shared_future<void> result = done->get_future().share();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      Job j = {job, after, done};
+      jobs.push_back(j);
+      pending++;
+      if (workers.size() < limit()) workers.push_back(std::thread(&PlotQueue::run, this));
+    }
+    watch(after);
+    changed.notify_all();
+    return result;
+  }
+
+  // blocks until every submitted job has finished
+  void wait_all() {
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [this]() { return pending == 0; });
+  }
+
+private:
+  struct Job {
+    std::function<void()> work;
+    std::vector< std::shared_future<void> > after;
+    std::shared_ptr< std::promise<void> > done;
+  };
+
+  struct Watcher {
+    std::thread thread;
+    std::shared_ptr< std::atomic<bool> > finished;
+  };
+
+  std::vector<std::thread> workers;
+  std::vector<Watcher> watchers; // guarded by watchers_mutex
+  std::mutex watchers_mutex;
+  std::deque<Job> jobs;
+  std::mutex mutex;
+  std::condition_variable changed, finished;
+  int pending = 0;
+  bool stopping = false;
+
+  // the pool is created first so it is destroyed after the queue has drained
+  PlotQueue() { GnuplotPool::shared(); }
+  PlotQueue(PlotQueue const&) = delete;
+  void operator=(PlotQueue const&) = delete;
+
+  static int limit() {
+    if (threads > 0) return threads;
+    int n = std::thread::hardware_concurrency();
+    return (n < 1) ? 1 : n;
+  }
+
+  // one thread per dependency that is not ready yet, which wakes the
+  // workers once it is. watchers that have finished are joined here
+  void watch(const std::vector< std::shared_future<void> >& after) {
+    std::lock_guard<std::mutex> lock(watchers_mutex);
+    for (int i = 0; i < watchers.size(); i++) {
+      if (!*watchers.at(i).finished) continue;
+      watchers.at(i).thread.join();
+      watchers.erase(watchers.begin() + i--);
+    }
+    for (int i = 0; i < after.size(); i++) {
+      if (after.at(i).wait_for(std::chrono::seconds(0)) == std::future_status::ready) continue;
+      Watcher w;
+      w.finished.reset(new std::atomic<bool>(false));
+      std::shared_future<void> dependency = after.at(i);
+      std::shared_ptr< std::atomic<bool> > finished = w.finished;
+      w.thread = std::thread([this, dependency, finished]() {
+        dependency.wait();
+        { std::lock_guard<std::mutex> lock(mutex); } // a worker is either waiting or will see it ready
+        changed.notify_all();
+        *finished = true;
+      });
+      watchers.push_back(std::move(w));
+    }
+  }
+
+  static bool ready(const Job& j) {
+    for (int i = 0; i < j.after.size(); i++)
+      if (j.after.at(i).wait_for(std::chrono::seconds(0)) != std::future_status::ready) return false;
+    return true;
+  }
+
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      std::deque<Job>::iterator it = jobs.begin();
+      while (it != jobs.end() && !ready(*it)) it++;
+      if (it == jobs.end()) {
+        if (stopping) return;
+        changed.wait(lock);
+        continue;
+      }
+      Job j = *it;
+      jobs.erase(it);
+      lock.unlock();
+      try {
+        for (int i = 0; i < j.after.size(); i++) j.after.at(i).get(); // a failed dependency fails the job
+        j.work();
+        j.done->set_value();
+      } catch (...) {
+        j.done->set_exception(std::current_exception());
+      }
+      lock.lock();
+      if (--pending == 0) finished.notify_all();
+      changed.notify_all(); // jobs may be waiting for this one
+    }
+  }
+};
+
+int PlotQueue::threads = 0;
+
+#endif // PLOT_QUEUE_H
@@ -7,16 +7,39 @@
 #include <sstream>
 #include <iomanip>
 #include <vector>
+#include <memory>
+#include <algorithm>
+#include <sys/stat.h>
 
 #include "gnuplot/gnuplot.hpp"
 #include "gnuplot/gnuplot_styles.hpp"
 #include "gnuplot/gnuplot_terms.hpp"
+#include "gnuplot/gnuplot_pool.hpp"
 #include "calc_util.hpp"
 
 class PlotScript {
+  private:
+    // gp is either owned here or leased from GnuplotPool::shared() (pooled)
+    std::unique_ptr<GnuplotPipe> own_pipe;
+    GnuplotPool::Worker* worker = NULL;
+    bool preloaded = false; // the leased worker already has the term and styles
+
+    // incremental mode: everything for gnuplot is collected in 'pending' and
+    // only sent by end() when its hash differs from the one stored with the
+    // output
+    bool deferred = false;
+    std::string pending;
+    std::string directory; // of the output, following 'cd' commands
+    std::string output;
+    std::vector<std::string> inputs; // existing files named in the commands
+
   public:
     static bool silent;
-    GnuplotPipe gp;
+    static bool pooled;
+    static bool incremental;
+    GnuplotPipe& gp;
+    bool quiet; // per script echo switch on top of the global 'silent'
+
     std::string term;
     std::string script_name;
     bool show_parameters = false;
@@ -38,17 +61,21 @@ class PlotScript {
       return "invalid type of style:"+type;
     }
 
-    PlotScript(std::string script_name_, std::string term = "png") {
+    PlotScript(std::string script_name_, std::string term = "png", bool quiet = false)
+    : gp(open_pipe(term)), quiet(quiet)
+    {
       if (term == "png") show_parameters = true;
       script_name = script_name_;
       set_term(term);
       set_extra();
       set_styles();
-
+      preloaded = false;
     }
 
+    ~PlotScript() { release(); }
+
     void set_styles() {
-      r_vec(gnuplot_styles);
+      r_vec(gnuplot_styles, !preloaded);
     }
 
     void set_extra() {
@@ -60,11 +87,12 @@ class PlotScript {
 
     void set_term(std::string term) {
       this->term = term;
-      r("chosen_term = '"+term+"'");
-      r_vec(gnuplot_terms);
+      r("chosen_term = '"+term+"'", false, !preloaded);
+      r_vec(gnuplot_terms, !preloaded);
     }
 
     void set_output(std::string outfilename) {
+      output = outfilename;
       r("set output '" + outfilename + "'.output_ext");
     }
 
@@ -108,18 +136,34 @@ class PlotScript {
       r("set " + the_rest);
     }
 
+    // a pooled gnuplot is handed back instead of exiting, once it has
+    // finished rendering; "exit" stays in the history so exported scripts
+    // are the same either way
     void end() {
       r("unset output");
-      r("exit");
+      r("exit", false, worker == NULL && !deferred);
+      if (deferred) render_if_changed();
+      if (worker) GnuplotPool::shared().sync(worker);
+      release();
     }
 
-    std::string r(std::string command, bool skip_history = false) {
-      if (!silent) std::cout << "gnuplot: " << command << std::endl;
+    std::string r(std::string command, bool skip_history = false, bool send = true) {
+      if (!silent && !quiet) std::cout << "gnuplot: " << command << std::endl;
       if (!skip_history) history.push_back(command);
-      gp.sendLine(command);
+      if (send && deferred) {
+        pending += command + "\n";
+        note_files(command);
+      }
+      else if (send && (worker || own_pipe)) gp.sendLine(command);
       return command;
     }
 
+    // raw bytes for an inline binary data block ('-' binary)
+    void send_data(const void* bytes, size_t size) {
+      if (deferred) pending.append((const char*) bytes, size);
+      else if (worker || own_pipe) gp.sendBinary(bytes, size);
+    }
+
     void r_file(std::string filepath) {
       std::ifstream inFile(filepath);
       std::string line;
@@ -129,9 +173,9 @@ class PlotScript {
       inFile.close();
     }
 
-    void r_vec(const std::vector<std::string> & commands) {
+    void r_vec(const std::vector<std::string> & commands, bool send = true) {
       for (int i = 0; i < commands.size(); i++)
-        r(commands.at(i));
+        r(commands.at(i), false, send);
     }
 
     void export_script(std::string filepath) {
@@ -146,9 +190,105 @@ class PlotScript {
 
   protected:
   private:
+    PlotScript(PlotScript const&) = delete;
+    void operator=(PlotScript const&) = delete;
+
+    GnuplotPipe& open_pipe(std::string term) {
+      if (incremental) {
+        deferred = true;
+        own_pipe.reset(new GnuplotPipe(nullptr));
+        return *own_pipe;
+      }
+      if (pooled) {
+        worker = GnuplotPool::shared().lease(term);
+        preloaded = true;
+        return *worker->pipe;
+      }
+      own_pipe.reset(new GnuplotPipe());
+      return *own_pipe;
+    }
 
+    void note_files(const std::string& command) {
+      if (command.compare(0, 4, "cd '") == 0) {
+        std::string dir = command.substr(4, command.find('\'', 4)-4);
+        directory = (dir.empty() || dir[0] == '/') ? dir : directory+dir;
+        if (!directory.empty() && directory.back() != '/') directory += "/";
+        return;
+      }
+      for (size_t i = 0; i < command.size(); i++) {
+        if (command[i] != '\'' && command[i] != '"') continue;
+        size_t close = command.find(command[i], i+1);
+        if (close == std::string::npos) break;
+        std::string name = command.substr(i+1, close-i-1);
+        std::string path = (!name.empty() && name[0] == '/') ? name : directory+name;
+        struct stat info;
+        if (!name.empty() && stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode)
+          && std::find(inputs.begin(), inputs.end(), path) == inputs.end())
+          inputs.push_back(path);
+        i = close;
+      }
+    }
+
+    std::string output_path() {
+      if (output.empty()) return "";
+      if (term == "png") return directory+output+".png";
+      if (term == "epslatex") return directory+output+".tex";
+      return "";
+    }
+
+    // the commands, the inline data and the contents of every file they name
+    uint64_t content_hash() {
+      uint64_t h = calc_util::hash_bytes(pending.data(), pending.size());
+      std::vector<char> chunk(1 << 20);
+      for (int i = 0; i < inputs.size(); i++) {
+        h = calc_util::hash_bytes(inputs.at(i).data(), inputs.at(i).size(), h);
+        std::ifstream in(inputs.at(i), std::ios::binary);
+        while (in) {
+          in.read(chunk.data(), chunk.size());
+          h = calc_util::hash_bytes(chunk.data(), in.gcount(), h);
+        }
+      }
+      return h;
+    }
+
+    // the hash of what produced an output is kept next to it in .plothash
+    void render_if_changed() {
+      std::string image = output_path();
+      std::string hash_path = image+".plothash";
+      std::string hash = std::to_string(content_hash());
+      struct stat info;
+      if (image != "" && stat(image.c_str(), &info) == 0) {
+        std::ifstream stored(hash_path);
+        std::string previous;
+        if (stored >> previous && previous == hash) {
+          if (!silent) std::cout << "gnuplot: " << image << " is up to date" << std::endl;
+          return;
+        }
+      }
+      if (pooled) {
+        worker = GnuplotPool::shared().lease(term);
+        worker->pipe->sendBinary(pending.data(), pending.size());
+        GnuplotPool::shared().sync(worker);
+        release();
+      } else {
+        GnuplotPipe pipe;
+        pipe.sendBinary(pending.data(), pending.size());
+        pipe.sendLine("exit");
+      } // gnuplot has finished once the pipe is closed
+      if (image == "") return;
+      std::ofstream stored(hash_path);
+      stored << hash << "\n";
+    }
+
+    void release() {
+      if (worker == NULL) return;
+      GnuplotPool::shared().release(worker);
+      worker = NULL;
+    }
 };
 
 bool PlotScript::silent = false;
+bool PlotScript::pooled = false;
+bool PlotScript::incremental = false;
 
 #endif
@@ -0,0 +1,89 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <cstdint>
+
+#include <unistd.h>
+
+/*
+ persistent map from point key to result row. the file is an append-only log
+ of records (uint64 key, uint64 n, double row[n]); a record cut short by a
+ crash is dropped and the file truncated before new records are appended.
+ rows that have been stored but not checkpointed are lost on a crash.
+*/
+class ResultCache {
+public:
+  ResultCache(std::string filepath): filepath(filepath) {
+    load();
+    log.open(filepath, std::ios::binary | std::ios::app);
+  }
+  ~ResultCache() { checkpoint(); }
+
+  size_t size() const { return offsets.size(); }
+
+  // safe to call from several threads as long as nobody stores meanwhile
+  bool lookup(uint64_t key, std::vector<double>& row) const {
+    std::unordered_map<uint64_t, size_t>::const_iterator it = offsets.find(key);
+    if (it == offsets.end()) return false;
+    size_t n = (size_t) values[it->second];
+    row.assign(values.begin() + it->second + 1, values.begin() + it->second + 1 + n);
+    return true;
+  }
+
+  void store(uint64_t key, const std::vector<double>& row) {
+    if (offsets.count(key)) return;
+    insert(key, row.data(), row.size());
+    uint64_t n = row.size();
+    pending.write((const char*) &key, 8);
+    pending.write((const char*) &n, 8);
+    pending.write((const char*) row.data(), 8*n);
+  }
+
+  // makes every stored row survive a crash
+  void checkpoint() {
+    std::string bytes = pending.str();
+    if (bytes.empty()) return;
+    log.write(bytes.data(), bytes.size());
+    log.flush();
+    pending.str("");
+  }
+
+private:
+  std::string filepath;
+  std::ofstream log;
+  std::ostringstream pending;
+  std::unordered_map<uint64_t, size_t> offsets; // key -> index of the row length in values
+  std::vector<double> values;
+
+  void insert(uint64_t key, const double* row, size_t n) {
+    offsets[key] = values.size();
+    values.push_back(n);
+    values.insert(values.end(), row, row+n);
+  }
+
+  void load() {
+    std::ifstream in(filepath, std::ios::binary);
+    if (!in) return;
+    std::vector<double> row;
+    std::streamoff valid = 0;
+    uint64_t key, n;
+    while (in.read((char*) &key, 8) && in.read((char*) &n, 8)) {
+      if (n > (1 << 24)) break; // garbage length, the rest is not trustworthy
+      row.resize(n);
+      if (n > 0 && !in.read((char*) row.data(), 8*n)) break;
+      if (!offsets.count(key)) insert(key, row.data(), n);
+      valid += 16 + 8*n;
+    }
+    in.close();
+    if (truncate(filepath.c_str(), valid) != 0)
+      std::cout << "result cache: could not truncate " << filepath << std::endl;
+  }
+};
+
+#endif // RESULT_CACHE_H
@@ -0,0 +1,127 @@
+#ifndef RESULT_SCHEMA_H
+#define RESULT_SCHEMA_H
+
+#include <string>
+#include <vector>
+#include <complex>
+#include <cmath>
+#include <algorithm>
+
+/*
+ typed columns of a result row. a real column takes one double, a complex
+ column two, interleaved (re, im) like a std::complex<double>, so a complex
+ value is stored with one copy. the stored headers of complex column z are
+ z.re and z.im, which is also how a schema is recovered from the headers of
+ a data file. plot commands can use <z.re> and <z.im> like any header, and
+ <z.abs> and <z.arg>, which map to gnuplot expressions on those two columns.
+*/
+class ResultSchema {
+public:
+  struct Column {
+    std::string name;
+    bool complex;
+    size_t offset; // of the real part, in doubles from the start of the row
+  };
+
+  ResultSchema& real(const std::string& name) { return add(name, false); }
+  ResultSchema& complex(const std::string& name) { return add(name, true); }
+
+  size_t size() const { return columns.size(); }
+  bool empty() const { return columns.empty(); }
+  size_t width() const { return row_width; } // doubles per row
+  const Column& operator[](size_t c) const { return columns[c]; }
+
+  int find(const std::string& name) const {
+    for (size_t c = 0; c < columns.size(); c++) if (columns[c].name == name) return c;
+    return -1;
+  }
+
+  std::vector<std::string> headers() const {
+    std::vector<std::string> names;
+    for (size_t c = 0; c < columns.size(); c++) {
+      if (!columns[c].complex) names.push_back(columns[c].name);
+      else { names.push_back(columns[c].name+".re"); names.push_back(columns[c].name+".im"); }
+    }
+    return names;
+  }
+
+  // adjacent headers z.re, z.im make complex column z, any other header a real one
+  static ResultSchema from_headers(const std::vector<std::string>& headers) {
+    ResultSchema schema;
+    for (size_t j = 0; j < headers.size(); j++) {
+      const std::string& h = headers[j];
+      std::string base = h.size() > 3 ? h.substr(0, h.size()-3) : "";
+      if (base != "" && h.compare(h.size()-3, 3, ".re") == 0
+        && j+1 < headers.size() && headers[j+1] == base+".im") {
+        schema.complex(base);
+        j++;
+      }
+      else schema.real(h);
+    }
+    return schema;
+  }
+
+  // gnuplot 'using' expressions of the derived columns of complex column c,
+  // columns counted from 1 as in gnuplot
+  std::string abs_expression(size_t c) const {
+    std::string re = std::to_string(columns[c].offset+1), im = std::to_string(columns[c].offset+2);
+    return "(sqrt(column("+re+")**2+column("+im+")**2))";
+  }
+  std::string arg_expression(size_t c) const {
+    std::string re = std::to_string(columns[c].offset+1), im = std::to_string(columns[c].offset+2);
+    return "(atan2(column("+im+"),column("+re+")))";
+  }
+
+private:
+  std::vector<Column> columns;
+  size_t row_width = 0;
+
+  ResultSchema& add(const std::string& name, bool complex) {
+    Column column = { name, complex, row_width };
+    columns.push_back(column);
+    row_width += complex ? 2 : 1;
+    return *this;
+  }
+};
+
+/*
+ a row slot written by column: row << x << z << growth stores the values in
+ schema order, row.set(c, value) any column. a complex value in a real
+ column keeps its real part, a real value in a complex one gets a zero
+ imaginary part. columns left unset read NaN, values past the last column
+ are dropped.
+*/
+class ResultRow {
+public:
+  ResultRow(const ResultSchema& schema, double* values): schema(schema), values(values) {
+    std::fill(values, values + schema.width(), NAN);
+  }
+
+  ResultRow& set(size_t c, double v) {
+    if (c >= schema.size()) return *this;
+    const ResultSchema::Column& column = schema[c];
+    values[column.offset] = v;
+    if (column.complex) values[column.offset+1] = 0.;
+    return *this;
+  }
+
+  ResultRow& set(size_t c, std::complex<double> z) {
+    if (c >= schema.size()) return *this;
+    const ResultSchema::Column& column = schema[c];
+    values[column.offset] = z.real();
+    if (column.complex) values[column.offset+1] = z.imag();
+    return *this;
+  }
+
+  ResultRow& operator<<(double v) { return set(next++, v); }
+  ResultRow& operator<<(std::complex<double> z) { return set(next++, z); }
+
+  double* data() const { return values; }
+
+private:
+  const ResultSchema& schema;
+  double* values;
+  size_t next = 0;
+};
+
+#endif // RESULT_SCHEMA_H
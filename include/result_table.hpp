@@ -0,0 +1,148 @@
+#ifndef RESULT_TABLE_H
+#define RESULT_TABLE_H
+
+#include <vector>
+#include <cstddef>
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+
+#include "data_file.hpp"
+
+/*
+ the rows of a sweep in one row-major block of doubles, width() values per
+ row. storage is reserved up front from the grid size, so filling it costs
+ no allocation per row and rows never move once the reservation holds.
+ rows read like the vectors they replace (table[i][j], table.size(),
+ range-for) and columns are strided views into the block.
+*/
+class ResultTable {
+public:
+  // one row, valid until the table grows past its reservation
+  template <typename T>
+  class Row {
+  public:
+    Row(T* values, size_t width): values(values), width(width) { }
+
+    size_t size() const { return width; }
+    bool empty() const { return width == 0; }
+    T* data() const { return values; }
+    T* begin() const { return values; }
+    T* end() const { return values + width; }
+    T& operator[](size_t j) const { return values[j]; }
+    T& at(size_t j) const {
+      if (j >= width) std::cout << "result table: column index out of range: " << j << std::endl;
+      return values[j];
+    }
+    operator std::vector<double>() const { return std::vector<double>(values, values + width); }
+
+  private:
+    T* values;
+    size_t width;
+  };
+
+  template <typename T>
+  class Iterator {
+  public:
+    Iterator(T* values, size_t width): values(values), width(width) { }
+    Row<T> operator*() const { return Row<T>(values, width); }
+    Iterator& operator++() { values += width; return *this; }
+    bool operator!=(const Iterator& b) const { return values != b.values; }
+    bool operator==(const Iterator& b) const { return values == b.values; }
+
+  private:
+    T* values;
+    size_t width;
+  };
+
+  ResultTable(size_t width = 0): columns(width) { }
+
+  size_t size() const { return num_rows; }
+  bool empty() const { return num_rows == 0; }
+  size_t width() const { return columns; }
+
+  // changes the row width; only allowed while the table is empty
+  void set_width(size_t width) {
+    if (num_rows > 0 && width != columns) {
+      std::cout << "result table: width change from " << columns << " to " << width << " ignored, table not empty" << std::endl;
+      return;
+    }
+    columns = width;
+  }
+
+  void reserve(size_t rows) { values.reserve(rows*columns); }
+  void clear() { values.clear(); num_rows = 0; }
+  void shrink_to_fit() { values.shrink_to_fit(); }
+
+  // slots for 'rows' new rows, to be filled by the caller
+  double* append(size_t rows = 1) {
+    values.resize(values.size() + rows*columns);
+    num_rows += rows;
+    return values.data() + (num_rows-rows)*columns;
+  }
+
+  // copies a row; short rows are padded with NaN and long ones truncated.
+  // the first row of a table without a width sets it.
+  void push_back(const double* row, size_t n) {
+    if (columns == 0 && num_rows == 0) columns = n;
+    if (n != columns && !warned_width) {
+      std::cout << "result table: row of " << n << " values for " << columns
+        << " columns, padding/truncating" << std::endl;
+      warned_width = true;
+    }
+    double* slot = append();
+    size_t copied = std::min(n, columns);
+    std::copy(row, row + copied, slot);
+    std::fill(slot + copied, slot + columns, NAN);
+  }
+  void push_back(const std::vector<double>& row) { push_back(row.data(), row.size()); }
+
+  // replaces the contents by rows x width() values, row-major
+  void assign(const double* records, size_t rows) {
+    values.assign(records, records + rows*columns);
+    num_rows = rows;
+  }
+
+  // adopts a row-major block of values.size()/width rows
+  void assign(std::vector<double>&& block, size_t width) {
+    columns = width;
+    values = std::move(block);
+    num_rows = (columns == 0) ? 0 : values.size()/columns;
+  }
+
+  Row<double> operator[](size_t i) { return Row<double>(values.data() + i*columns, columns); }
+  Row<const double> operator[](size_t i) const { return Row<const double>(values.data() + i*columns, columns); }
+  Row<double> at(size_t i) {
+    if (i >= num_rows) std::cout << "result table: row index out of range: " << i << std::endl;
+    return (*this)[i];
+  }
+  Row<const double> at(size_t i) const {
+    if (i >= num_rows) std::cout << "result table: row index out of range: " << i << std::endl;
+    return (*this)[i];
+  }
+  Row<double> front() { return (*this)[0]; }
+  Row<double> back() { return (*this)[num_rows-1]; }
+  Row<const double> front() const { return (*this)[0]; }
+  Row<const double> back() const { return (*this)[num_rows-1]; }
+
+  Iterator<double> begin() { return Iterator<double>(values.data(), columns); }
+  Iterator<double> end() { return Iterator<double>(values.data() + num_rows*columns, columns); }
+  Iterator<const double> begin() const { return Iterator<const double>(values.data(), columns); }
+  Iterator<const double> end() const { return Iterator<const double>(values.data() + num_rows*columns, columns); }
+
+  // all rows, row-major
+  const double* records() const { return values.data(); }
+
+  ColumnView column(size_t j) const {
+    ColumnView view = { values.data() + j, columns, num_rows };
+    return view;
+  }
+
+private:
+  std::vector<double> values;
+  size_t columns;
+  size_t num_rows = 0;
+  bool warned_width = false;
+};
+
+#endif // RESULT_TABLE_H
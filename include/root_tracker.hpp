@@ -0,0 +1,108 @@
+#ifndef ROOT_TRACKER_H
+#define ROOT_TRACKER_H
+
+#include <vector>
+#include <complex>
+
+#include "calculation.hpp"
+#include "newton_raphson.hpp"
+
+/*
+ continuation of a root along a Calculation sweep. register the tracker in
+ Calculation::listeners and call solve() from the iteration function instead
+ of NewtonRaphson::solve: the guess is extrapolated from the roots found at
+ the previous points of the current line (order 0: previous root, 1: linear,
+ 2: quadratic in the value of the 'along' variable). the first point of a
+ line starts from the first root of the previous line, and the fallback
+ guess is only used when nothing is known or the tracked solve fails. only
+ the serial work() drives a tracker; a point read from the cache ends the
+ extrapolation, which restarts from the line's first root.
+*/
+class RootTracker: public SweepListener {
+public:
+  int order;
+  long solves = 0;
+  long total_iterations = 0;
+  long fallbacks = 0;
+
+  RootTracker(NewtonRaphson& nr, Variable& along, int order = 1)
+  : order(order), nr(nr), along(along)
+  { }
+
+  void begin_sweep() {
+    history_s.clear(); history_z.clear();
+    have_line_start = have_previous_line_start = false;
+    solves = total_iterations = fallbacks = 0;
+  }
+
+  void begin_line() {
+    if (have_line_start) {
+      previous_line_start = line_start;
+      have_previous_line_start = true;
+    }
+    have_line_start = false;
+    history_s.clear(); history_z.clear();
+  }
+
+  // the roots before a cached point are not the neighbours of the next one
+  void skipped() {
+    if (have_line_start) {
+      previous_line_start = line_start;
+      have_previous_line_start = true;
+    }
+    history_s.clear(); history_z.clear();
+  }
+
+  NewtonRaphson::result solve(std::complex<double>(*f_zero)(std::complex<double>),
+    std::complex<double> fallback_guess, double epsabs, double epsrel)
+  {
+    std::complex<double> s = along;
+    bool tracked = !history_z.empty() || have_previous_line_start;
+    NewtonRaphson::result r = nr.solve(f_zero, tracked ? guess(s) : fallback_guess, epsabs, epsrel);
+    total_iterations += r.iterations;
+    if (tracked && r.status != NR_SUCCESS) {
+      // lost the branch, start over from the fallback
+      fallbacks++;
+      history_s.clear(); history_z.clear();
+      r = nr.solve(f_zero, fallback_guess, epsabs, epsrel);
+      total_iterations += r.iterations;
+    }
+    solves++;
+    if (r.status == NR_SUCCESS) {
+      history_s.push_back(s); history_z.push_back(r.z);
+      if (history_z.size() > 3) { history_s.erase(history_s.begin()); history_z.erase(history_z.begin()); }
+      if (!have_line_start) { line_start = r.z; have_line_start = true; }
+    }
+    return r;
+  }
+
+  double mean_iterations() const { return solves ? (double) total_iterations/solves : 0.; }
+
+private:
+  NewtonRaphson& nr;
+  Variable& along;
+  std::vector<std::complex<double> > history_s, history_z;
+  std::complex<double> line_start, previous_line_start;
+  bool have_line_start = false, have_previous_line_start = false;
+
+  // Lagrange extrapolation through the last order+1 roots of the line
+  std::complex<double> guess(std::complex<double> s) const {
+    if (history_z.empty()) return previous_line_start;
+    int n = history_z.size();
+    int points = (order+1 < n) ? order+1 : n;
+    if (points < 1) points = 1;
+    std::complex<double> z = 0.;
+    for (int a = n-points; a < n; a++) {
+      std::complex<double> weight = 1.;
+      for (int b = n-points; b < n; b++) {
+        if (b == a) continue;
+        if (history_s[a] == history_s[b]) return history_z.back();
+        weight *= (s - history_s[b])/(history_s[a] - history_s[b]);
+      }
+      z += weight*history_z[a];
+    }
+    return z;
+  }
+};
+
+#endif // ROOT_TRACKER_H
@@ -0,0 +1,172 @@
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <iostream>
+
+#include "philox.hpp"
+
+/*
+ points of the unit cube [0,1)^dims for sampled sweeps: plain Monte Carlo,
+ Latin hypercube, or the Sobol and Halton low-discrepancy sequences. every
+ coordinate unit(i, d) is a pure function of the seed, the sample index and
+ the dimension, so a sweep gives the same samples whatever the number of
+ threads or shards. the quasi-random sequences are randomised by a
+ seed-derived shift (a digital shift for Sobol, a shift modulo 1 for
+ Halton), which keeps their uniformity and makes seeds independent
+ replicates.
+*/
+class Sampler {
+public:
+  enum Method { MONTE_CARLO, LATIN_HYPERCUBE, SOBOL, HALTON };
+  static const size_t max_sobol_dims = 21;
+
+  Sampler(Method method, size_t dims, size_t samples, uint64_t seed = 0)
+  : method(method), dims(dims), samples(samples), philox(seed)
+  {
+    if (method == SOBOL && dims > max_sobol_dims) {
+      std::cout << "sampler: sobol directions for at most " << max_sobol_dims
+        << " dimensions, using halton for " << dims << std::endl;
+      this->method = HALTON;
+    }
+    // per dimension shifts and permutation keys, from a counter range of
+    // their own
+    for (size_t d = 0; d < dims; d++) {
+      Philox::Block b = philox(d, 1ULL << 63);
+      shift.push_back(Philox::to_unit(b[0], b[1]));
+      keys.push_back(((uint64_t) b[2] << 32) | b[3]);
+    }
+    if (this->method == SOBOL) sobol_directions();
+    if (this->method == HALTON) for (size_t d = 0; d < dims; d++) bases.push_back(prime(d));
+    if (this->method == LATIN_HYPERCUBE) {
+      bits = 2;
+      while (bits < 64 && (1ULL << bits) < samples) bits += 2;
+    }
+  }
+
+  Method get_method() const { return method; }
+
+  // coordinate d of sample i, in [0,1)
+  double unit(size_t i, size_t d) const {
+    switch (method) {
+      case MONTE_CARLO: return philox.uniform(i, d/2, d%2);
+      case LATIN_HYPERCUBE: return (permute(i, d) + philox.uniform(i, (d/2) | (1ULL << 62), d%2))/samples;
+      case SOBOL: {
+        uint32_t x = 0;
+        for (int k = 0; k < 32 && (i >> k); k++) if ((i >> k) & 1) x ^= directions[d*32 + k];
+        return (x ^ (uint32_t) keys[d]) * (1.0/4294967296.0);
+      }
+      case HALTON: {
+        double u = radical_inverse(i+1, bases[d]) + shift[d];
+        return u - std::floor(u);
+      }
+    }
+    return 0.;
+  }
+
+  // mc, lhs, sobol or halton
+  static bool parse(const std::string& name, Method& method) {
+    if (name == "mc") method = MONTE_CARLO;
+    else if (name == "lhs") method = LATIN_HYPERCUBE;
+    else if (name == "sobol") method = SOBOL;
+    else if (name == "halton") method = HALTON;
+    else return false;
+    return true;
+  }
+
+  static std::string name(Method method) {
+    const char* names[] = { "mc", "lhs", "sobol", "halton" };
+    return names[method];
+  }
+
+private:
+  Method method;
+  size_t dims, samples;
+  Philox philox;
+  std::vector<double> shift;
+  std::vector<uint64_t> keys;
+  std::vector<uint32_t> directions; // 32 per dimension
+  std::vector<uint32_t> bases; // of the Halton sequence, the first primes
+  int bits = 0; // of the Feistel domain of the Latin hypercube permutations
+
+  /*
+   Latin hypercube stratum of sample i along d: a random permutation of
+   0 .. samples-1 per dimension, computed on demand instead of stored. a
+   keyed Feistel network permutes the smallest power of four domain that
+   holds the samples, and values outside the range are walked on until they
+   fall inside, which takes under four steps on average.
+  */
+  size_t permute(size_t i, size_t d) const {
+    int half = bits/2;
+    uint64_t mask = (1ULL << half) - 1, x = i;
+    do {
+      uint64_t left = x >> half, right = x & mask;
+      for (int r = 0; r < 4; r++) {
+        uint64_t f = mix(right ^ (keys[d] + r*0x9E3779B97F4A7C15ULL)) & mask;
+        uint64_t next = left ^ f;
+        left = right;
+        right = next;
+      }
+      x = (left << half) | right;
+    } while (x >= samples);
+    return x;
+  }
+
+  static uint64_t mix(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+  }
+
+  static double radical_inverse(uint64_t i, uint32_t base) {
+    double inverse = 1./base, scale = inverse, u = 0.;
+    for (; i > 0; i /= base, scale *= inverse) u += (i % base)*scale;
+    return u;
+  }
+
+  static uint32_t prime(size_t d) {
+    uint32_t p = 1;
+    for (size_t found = 0; found <= d; ) {
+      p++;
+      bool is_prime = true;
+      for (uint32_t q = 2; q*q <= p && is_prime; q++) is_prime = (p % q != 0);
+      if (is_prime) found++;
+    }
+    return p;
+  }
+
+  // direction numbers from the primitive polynomials and initial values of
+  // Joe and Kuo (new-joe-kuo-6.21201); dimension 0 is the van der Corput
+  // sequence in base 2
+  void sobol_directions() {
+    static const uint32_t table[max_sobol_dims-1][9] = {
+      // degree s, coefficients a, m_1 .. m_s
+      {1, 0, 1}, {2, 1, 1, 3}, {3, 1, 1, 3, 1}, {3, 2, 1, 1, 1},
+      {4, 1, 1, 1, 3, 3}, {4, 4, 1, 3, 5, 13}, {5, 2, 1, 1, 5, 5, 17},
+      {5, 4, 1, 1, 5, 5, 5}, {5, 7, 1, 1, 7, 11, 19}, {5, 11, 1, 1, 5, 1, 1},
+      {5, 13, 1, 1, 1, 3, 11}, {5, 14, 1, 3, 5, 5, 31}, {6, 1, 1, 3, 3, 9, 7, 49},
+      {6, 13, 1, 1, 1, 15, 21, 21}, {6, 16, 1, 3, 1, 13, 27, 49},
+      {6, 19, 1, 1, 1, 15, 7, 5}, {6, 22, 1, 3, 1, 15, 13, 25},
+      {6, 25, 1, 1, 5, 5, 19, 61}, {7, 1, 1, 3, 7, 11, 23, 15, 103},
+      {7, 4, 1, 3, 7, 13, 13, 15, 69}
+    };
+    directions.assign(dims*32, 0);
+    for (int k = 0; k < 32 && dims > 0; k++) directions[k] = 1U << (31-k);
+    for (size_t d = 1; d < dims; d++) {
+      const uint32_t* row = table[d-1];
+      uint32_t s = row[0], a = row[1];
+      uint32_t* v = &directions[d*32];
+      for (uint32_t k = 0; k < s && k < 32; k++) v[k] = row[2+k] << (31-k);
+      for (uint32_t k = s; k < 32; k++) {
+        v[k] = v[k-s] ^ (v[k-s] >> s);
+        for (uint32_t l = 1; l < s; l++) if ((a >> (s-1-l)) & 1) v[k] ^= v[k-l];
+      }
+    }
+  }
+};
+
+#endif // SAMPLING_H
@@ -0,0 +1,94 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <cstddef>
+
+/*
+ the part of a sweep's flattened grid that one process computes. shard k of
+ N takes the contiguous run of flat indices [k*total/N, (k+1)*total/N), or,
+ strided, every N-th index starting at k, which spreads an expensive corner
+ of the grid over all shards. point i of the shard is flat index at(i). a
+ count of 1 is the whole grid.
+*/
+struct Shard {
+  size_t index = 0;
+  size_t count = 1;
+  bool strided = false;
+
+  bool active() const { return count > 1; }
+  size_t step() const { return strided ? count : 1; }
+
+  size_t first(size_t total) const { return strided ? index : index*total/count; }
+
+  size_t size(size_t total) const {
+    if (strided) return (total > index) ? (total - index + count-1)/count : 0;
+    return (index+1)*total/count - index*total/count;
+  }
+
+  size_t at(size_t i, size_t total) const { return first(total) + i*step(); }
+
+  // "k/N", false if malformed
+  bool parse(const std::string& spec) {
+    size_t slash = spec.find('/');
+    if (slash == std::string::npos) return false;
+    try {
+      std::string first = spec.substr(0, slash), second = spec.substr(slash+1);
+      size_t used_k, used_n;
+      long k = std::stol(first, &used_k), n = std::stol(second, &used_n);
+      if (used_k != first.size() || used_n != second.size()) return false;
+      if (n < 1 || k < 0 || k >= n) return false;
+      index = k;
+      count = n;
+    } catch (...) { return false; }
+    return true;
+  }
+
+  // appended to the names of the files a shard writes
+  std::string suffix() const {
+    if (!active()) return "";
+    return ".shard-"+std::to_string(index)+"-of-"+std::to_string(count);
+  }
+
+  /*
+   <part>.info, written next to a part once it is complete, so a merge knows
+   how the part's rows map onto the grid:
+     shard <k> <N> contiguous|strided
+     total <points in the grid>
+     rows <rows in the part>
+     shape <points per variable>...
+  */
+  void write_info(const std::string& path, size_t total, size_t rows, const std::vector<size_t>& shape) const {
+    std::ofstream out(path);
+    out << "shard " << index << " " << count << " " << (strided ? "strided" : "contiguous") << "\n";
+    out << "total " << total << "\n";
+    out << "rows " << rows << "\n";
+    out << "shape";
+    for (size_t d = 0; d < shape.size(); d++) out << " " << shape[d];
+    out << "\n";
+  }
+
+  bool read_info(const std::string& path, size_t& total, size_t& rows, std::vector<size_t>& shape) {
+    std::ifstream in(path);
+    std::string line, key, mode;
+    bool complete = false;
+    shape.clear();
+    while (std::getline(in, line)) {
+      std::istringstream words(line);
+      words >> key;
+      if (key == "shard") {
+        words >> index >> count >> mode;
+        strided = (mode == "strided");
+      }
+      else if (key == "total") words >> total;
+      else if (key == "rows") { words >> rows; complete = true; }
+      else if (key == "shape") for (size_t n; words >> n; ) shape.push_back(n);
+    }
+    return complete;
+  }
+};
+
+#endif // SHARD_H
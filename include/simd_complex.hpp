@@ -0,0 +1,195 @@
+#ifndef SIMD_COMPLEX_H
+#define SIMD_COMPLEX_H
+
+#include <complex>
+#include <cmath>
+#include <cstdlib>
+#include <cstddef>
+
+// lanes per pack: one AVX-512 register holds 8 doubles, AVX2 holds 4
+#ifndef CALC_SIMD_WIDTH
+#if defined(__AVX512F__)
+#define CALC_SIMD_WIDTH 8
+#else
+#define CALC_SIMD_WIDTH 4
+#endif
+#endif
+
+#define CALC_SIMD_ALIGN 64
+
+// 64 byte aligned array of doubles for structure-of-arrays blocks
+class AlignedBuffer {
+public:
+  AlignedBuffer(size_t n = 0) { resize(n); }
+  ~AlignedBuffer() { std::free(values); }
+
+  void resize(size_t n) {
+    std::free(values);
+    values = NULL;
+    length = n;
+    if (n == 0) return;
+    size_t bytes = ((n*sizeof(double) + CALC_SIMD_ALIGN-1)/CALC_SIMD_ALIGN)*CALC_SIMD_ALIGN;
+    values = (double*) std::aligned_alloc(CALC_SIMD_ALIGN, bytes);
+  }
+
+  size_t size() const { return length; }
+  double* data() { return values; }
+  const double* data() const { return values; }
+  double& operator[](size_t i) { return values[i]; }
+  const double& operator[](size_t i) const { return values[i]; }
+
+private:
+  AlignedBuffer(AlignedBuffer const&) = delete;
+  void operator=(AlignedBuffer const&) = delete;
+
+  double* values = NULL;
+  size_t length = 0;
+};
+
+/*
+ W complex numbers in split (real/imaginary) layout. every operation is a
+ plain loop over the lanes, which the compiler turns into packed AVX2/AVX-512
+ instructions (-O2 -mavx2 or -march=native) instead of the scalar shuffles
+ that interleaved std::complex arithmetic needs.
+*/
+template <int W = CALC_SIMD_WIDTH>
+struct cd_pack {
+  alignas(CALC_SIMD_ALIGN) double re[W];
+  alignas(CALC_SIMD_ALIGN) double im[W];
+
+  static const int width = W;
+
+  static cd_pack load(const double* re_in, const double* im_in) {
+    cd_pack z;
+    for (int k = 0; k < W; k++) { z.re[k] = re_in[k]; z.im[k] = im_in[k]; }
+    return z;
+  }
+
+  static cd_pack broadcast(std::complex<double> c) {
+    cd_pack z;
+    for (int k = 0; k < W; k++) { z.re[k] = c.real(); z.im[k] = c.imag(); }
+    return z;
+  }
+
+  void store(double* re_out, double* im_out) const {
+    for (int k = 0; k < W; k++) { re_out[k] = re[k]; im_out[k] = im[k]; }
+  }
+
+  std::complex<double> lane(int k) const { return std::complex<double>(re[k], im[k]); }
+
+  cd_pack operator+(const cd_pack& b) const {
+    cd_pack z;
+    for (int k = 0; k < W; k++) { z.re[k] = re[k]+b.re[k]; z.im[k] = im[k]+b.im[k]; }
+    return z;
+  }
+
+  cd_pack operator-(const cd_pack& b) const {
+    cd_pack z;
+    for (int k = 0; k < W; k++) { z.re[k] = re[k]-b.re[k]; z.im[k] = im[k]-b.im[k]; }
+    return z;
+  }
+
+  cd_pack operator-() const {
+    cd_pack z;
+    for (int k = 0; k < W; k++) { z.re[k] = -re[k]; z.im[k] = -im[k]; }
+    return z;
+  }
+
+  cd_pack operator*(const cd_pack& b) const {
+    cd_pack z;
+    for (int k = 0; k < W; k++) {
+      z.re[k] = re[k]*b.re[k] - im[k]*b.im[k];
+      z.im[k] = re[k]*b.im[k] + im[k]*b.re[k];
+    }
+    return z;
+  }
+
+  cd_pack operator*(double s) const {
+    cd_pack z;
+    for (int k = 0; k < W; k++) { z.re[k] = re[k]*s; z.im[k] = im[k]*s; }
+    return z;
+  }
+
+  // textbook division, no Smith scaling: fine unless |b| approaches overflow
+  cd_pack operator/(const cd_pack& b) const {
+    cd_pack z;
+    for (int k = 0; k < W; k++) {
+      double d = b.re[k]*b.re[k] + b.im[k]*b.im[k];
+      z.re[k] = (re[k]*b.re[k] + im[k]*b.im[k])/d;
+      z.im[k] = (im[k]*b.re[k] - re[k]*b.im[k])/d;
+    }
+    return z;
+  }
+
+  cd_pack& operator+=(const cd_pack& b) { *this = *this + b; return *this; }
+  cd_pack& operator-=(const cd_pack& b) { *this = *this - b; return *this; }
+  cd_pack& operator*=(const cd_pack& b) { *this = *this * b; return *this; }
+  cd_pack& operator/=(const cd_pack& b) { *this = *this / b; return *this; }
+};
+
+template <int W> cd_pack<W> conj(const cd_pack<W>& a) {
+  cd_pack<W> z;
+  for (int k = 0; k < W; k++) { z.re[k] = a.re[k]; z.im[k] = -a.im[k]; }
+  return z;
+}
+
+// |z|^2 of every lane
+template <int W> void norm(const cd_pack<W>& a, double* out) {
+  for (int k = 0; k < W; k++) out[k] = a.re[k]*a.re[k] + a.im[k]*a.im[k];
+}
+
+template <int W> void abs(const cd_pack<W>& a, double* out) {
+  for (int k = 0; k < W; k++) out[k] = std::sqrt(a.re[k]*a.re[k] + a.im[k]*a.im[k]);
+}
+
+template <int W> void arg(const cd_pack<W>& a, double* out) {
+  for (int k = 0; k < W; k++) out[k] = std::atan2(a.im[k], a.re[k]);
+}
+
+// vectorises with glibc's libmvec under -O3 -ffast-math, scalar calls otherwise
+template <int W> cd_pack<W> exp(const cd_pack<W>& a) {
+  cd_pack<W> z;
+  for (int k = 0; k < W; k++) {
+    double m = std::exp(a.re[k]);
+    z.re[k] = m*std::cos(a.im[k]);
+    z.im[k] = m*std::sin(a.im[k]);
+  }
+  return z;
+}
+
+// principal branch, like std::sqrt(std::complex)
+template <int W> cd_pack<W> sqrt(const cd_pack<W>& a) {
+  cd_pack<W> z;
+  for (int k = 0; k < W; k++) {
+    double m = std::sqrt(a.re[k]*a.re[k] + a.im[k]*a.im[k]);
+    double r = std::sqrt(0.5*(m + a.re[k]));
+    double i = std::sqrt(0.5*(m - a.re[k]));
+    z.re[k] = r;
+    z.im[k] = (a.im[k] < 0) ? -i : i;
+  }
+  return z;
+}
+
+/*
+ calls kernel(cd_pack<W>& z, size_t i) on every full pack of a split complex
+ block and on the zero padded tail, storing the result back in place of z.
+ blocks handed out by Calculation are padded to a multiple of the pack width.
+*/
+template <int W = CALC_SIMD_WIDTH, typename Kernel>
+void for_each_pack(size_t n, const double* re_in, const double* im_in,
+  double* re_out, double* im_out, Kernel kernel)
+{
+  size_t i = 0;
+  for (; i + W <= n; i += W) {
+    cd_pack<W> z = cd_pack<W>::load(re_in+i, im_in+i);
+    kernel(z, i);
+    z.store(re_out+i, im_out+i);
+  }
+  if (i == n) return;
+  cd_pack<W> z = cd_pack<W>::broadcast(0.);
+  for (size_t k = 0; i+k < n; k++) { z.re[k] = re_in[i+k]; z.im[k] = im_in[i+k]; }
+  kernel(z, i);
+  for (size_t k = 0; i+k < n; k++) { re_out[i+k] = z.re[k]; im_out[i+k] = z.im[k]; }
+}
+
+#endif // SIMD_COMPLEX_H
@@ -0,0 +1,243 @@
+#ifndef SWEEP_STATS_H
+#define SWEEP_STATS_H
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cmath>
+#include <fstream>
+#include <functional>
+
+/*
+ instrumentation of a Calculation sweep: throughput and ETA while it runs,
+ and afterwards a log2 histogram of the iteration function's latency, the
+ split of the time between computing, formatting and file I/O, and the cost
+ of each region of the grid (the first two variables, in at most
+ region_bins bins each). counters are kept per worker, so the hot path is
+ two clock reads and a few additions. defining CALC_NO_INSTRUMENTATION
+ turns every member into a no-op the compiler removes, clock reads included.
+*/
+class SweepStats {
+public:
+#ifdef CALC_NO_INSTRUMENTATION
+  static const bool enabled = false;
+#else
+  static const bool enabled = true;
+#endif
+  static const int histogram_bins = 40; // bin k: latencies in [2^k, 2^(k+1)) ns
+  static const int region_bins = 32;
+  static double progress_interval; // seconds between progress lines, 0 for none
+
+  typedef std::chrono::steady_clock clock;
+  typedef clock::time_point stamp;
+
+  static stamp now() { return enabled ? clock::now() : stamp(); }
+
+  void begin(size_t total_points, const std::vector<size_t>& grid_shape, int num_workers) {
+    if (!enabled) return;
+    total = total_points;
+    shape = grid_shape;
+    bins.clear();
+    for (int d = 0; d < 2 && d < shape.size(); d++)
+      bins.push_back(shape[d] < region_bins ? (shape[d] ? shape[d] : 1) : region_bins);
+    size_t regions = 1;
+    for (int d = 0; d < bins.size(); d++) regions *= bins[d];
+    workers.assign(num_workers < 1 ? 1 : num_workers, Counters());
+    for (int w = 0; w < workers.size(); w++) {
+      workers[w].region_ns.assign(regions, 0);
+      workers[w].region_calls.assign(regions, 0);
+    }
+    stored_rows = 0;
+    store_untimed = false;
+    store_seconds = io_seconds = wall_seconds = 0.;
+    start = last_progress = clock::now();
+  }
+
+  // one call of the iteration function for 'points' points (a whole block
+  // for batched sweeps) starting at the grid point coords, begun at 'since'
+  void call(int worker, const std::vector<size_t>& coords, stamp since, size_t points = 1) {
+    if (!enabled) return;
+    uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - since).count();
+    Counters& c = workers[worker];
+    c.calls += points;
+    c.compute_ns += ns;
+    uint64_t per_point = ns/points;
+    int bin = per_point ? 63 - __builtin_clzll(per_point) : 0;
+    c.histogram[bin < histogram_bins ? bin : histogram_bins-1] += points;
+    size_t region = region_of(coords);
+    c.region_ns[region] += ns;
+    c.region_calls[region] += points;
+  }
+
+  // rows handed to the sinks, which took since .. now
+  void stored(size_t rows, stamp since) {
+    if (!enabled) return;
+    stored_rows += rows;
+    store_seconds += std::chrono::duration<double>(clock::now() - since).count();
+  }
+
+  // untimed variant for loops that store each row right after computing it:
+  // the store time is then taken as what the compute time leaves of the wall
+  void stored(size_t rows) {
+    if (!enabled) return;
+    stored_rows += rows;
+    store_untimed = true;
+  }
+
+  // a progress line with rate and ETA once every progress_interval, else ""
+  std::string progress() {
+    if (!enabled || progress_interval <= 0.) return "";
+    stamp t = clock::now();
+    if (std::chrono::duration<double>(t - last_progress).count() < progress_interval) return "";
+    last_progress = t;
+    double elapsed = std::chrono::duration<double>(t - start).count();
+    double rate = stored_rows/elapsed;
+    char line[160];
+    std::snprintf(line, sizeof(line), "progress: %zu/%zu points (%.1f%%), %.4g points/s, eta %s",
+      stored_rows, total, total ? 100.*stored_rows/total : 100., rate,
+      duration(rate > 0. ? (total - stored_rows)/rate : 0.).c_str());
+    return line;
+  }
+
+  // io: seconds the sinks spent writing, part of the store time
+  void end(double sink_io_seconds) {
+    if (!enabled) return;
+    wall_seconds = std::chrono::duration<double>(clock::now() - start).count();
+    io_seconds = sink_io_seconds;
+    if (store_untimed) store_seconds = wall_seconds - compute_seconds();
+  }
+
+  std::string summary() const {
+    if (!enabled) return "";
+    char line[256];
+    std::snprintf(line, sizeof(line),
+      "stats: %.4g points/s, wall %.3fs, compute %.3fs (summed wall), format %.3fs, io %.3fs, latency p50 %s p99 %s",
+      wall_seconds > 0. ? stored_rows/wall_seconds : 0., wall_seconds, compute_seconds(),
+      store_seconds - io_seconds, io_seconds, latency(0.5).c_str(), latency(0.99).c_str());
+    return line;
+  }
+
+  // <base>.stats.json and <base>.regions.csv; axis_value(d, i) is the value of
+  // point i of variable d, for the region bounds in the csv
+  void write(const std::string& base, const std::vector<std::string>& axis_names,
+    std::function<double(int, size_t)> axis_value) const
+  {
+    if (!enabled) return;
+    std::ofstream json(base+".stats.json");
+    json << "{\n  \"points\": " << stored_rows << ",\n";
+    json << "  \"computed\": " << calls() << ",\n";
+    json << "  \"workers\": " << workers.size() << ",\n";
+    json << "  \"wall_seconds\": " << wall_seconds << ",\n";
+    json << "  \"points_per_second\": " << (wall_seconds > 0. ? stored_rows/wall_seconds : 0.) << ",\n";
+    json << "  \"compute_summed_wall_seconds\": " << compute_seconds() << ",\n";
+    json << "  \"format_seconds\": " << store_seconds - io_seconds << ",\n";
+    json << "  \"io_seconds\": " << io_seconds << ",\n";
+    json << "  \"latency_ns\": {\"p50\": " << latency_ns(0.5) << ", \"p90\": " << latency_ns(0.9)
+      << ", \"p99\": " << latency_ns(0.99) << "},\n";
+    json << "  \"latency_histogram\": [";
+    bool first = true;
+    for (int b = 0; b < histogram_bins; b++) {
+      uint64_t n = histogram(b);
+      if (n == 0) continue;
+      json << (first ? "\n" : ",\n") << "    {\"from_ns\": " << (1ULL << b) << ", \"to_ns\": " << (2ULL << b)
+        << ", \"calls\": " << n << "}";
+      first = false;
+    }
+    json << "\n  ]\n}\n";
+
+    std::ofstream csv(base+".regions.csv");
+    for (int d = 0; d < bins.size(); d++)
+      csv << axis_names.at(d) << "_from," << axis_names.at(d) << "_to,";
+    csv << "points,seconds,mean_us\n";
+    size_t regions = (total == 0 || workers.empty()) ? 0 : workers[0].region_calls.size();
+    for (size_t r = 0; r < regions; r++) {
+      uint64_t n = 0;
+      double seconds = 0.;
+      for (int w = 0; w < workers.size(); w++) { n += workers[w].region_calls[r]; seconds += workers[w].region_ns[r]*1e-9; }
+      size_t rest = r;
+      std::vector<size_t> bin(bins.size());
+      for (int d = bins.size()-1; d >= 0; d--) { bin[d] = rest % bins[d]; rest /= bins[d]; }
+      for (int d = 0; d < bins.size(); d++) {
+        size_t first_point = bin[d]*shape[d]/bins[d], last_point = (bin[d]+1)*shape[d]/bins[d] - 1;
+        csv << axis_value(d, first_point) << "," << axis_value(d, last_point) << ",";
+      }
+      csv << n << "," << seconds << "," << (n ? seconds*1e6/n : 0.) << "\n";
+    }
+  }
+
+private:
+  // cache line aligned, so neighbouring workers do not share hot counters
+  struct alignas(64) Counters {
+    uint64_t calls = 0;
+    uint64_t compute_ns = 0;
+    uint64_t histogram[histogram_bins] = {};
+    std::vector<uint64_t> region_ns;
+    std::vector<uint64_t> region_calls;
+  };
+
+  std::vector<Counters> workers;
+  std::vector<size_t> shape, bins;
+  size_t total = 0, stored_rows = 0;
+  bool store_untimed = false;
+  double store_seconds = 0., io_seconds = 0., wall_seconds = 0.;
+  stamp start, last_progress;
+
+  size_t region_of(const std::vector<size_t>& coords) const {
+    size_t region = 0;
+    for (int d = 0; d < bins.size(); d++) region = region*bins[d] + coords[d]*bins[d]/shape[d];
+    return region;
+  }
+
+  uint64_t calls() const {
+    uint64_t n = 0;
+    for (int w = 0; w < workers.size(); w++) n += workers[w].calls;
+    return n;
+  }
+
+  // wall time of the calls, summed over the workers: the cpu time they took
+  // when no worker waited, up to workers times the sweep's wall time
+  double compute_seconds() const {
+    uint64_t ns = 0;
+    for (int w = 0; w < workers.size(); w++) ns += workers[w].compute_ns;
+    return ns*1e-9;
+  }
+
+  uint64_t histogram(int b) const {
+    uint64_t n = 0;
+    for (int w = 0; w < workers.size(); w++) n += workers[w].histogram[b];
+    return n;
+  }
+
+  // upper edge of the histogram bin holding quantile q
+  double latency_ns(double q) const {
+    uint64_t n = calls(), seen = 0;
+    if (n == 0) return 0.;
+    for (int b = 0; b < histogram_bins; b++) {
+      seen += histogram(b);
+      if (seen >= q*n) return (double) (2ULL << b);
+    }
+    return (double) (2ULL << (histogram_bins-1));
+  }
+
+  std::string latency(double q) const {
+    double ns = latency_ns(q);
+    char text[32];
+    if (ns < 1e3) std::snprintf(text, sizeof(text), "<%.0fns", ns);
+    else if (ns < 1e6) std::snprintf(text, sizeof(text), "<%.0fus", ns/1e3);
+    else std::snprintf(text, sizeof(text), "<%.0fms", ns/1e6);
+    return text;
+  }
+
+  static std::string duration(double seconds) {
+    long s = (long) (seconds + 0.5);
+    char text[32];
+    std::snprintf(text, sizeof(text), "%ld:%02ld:%02ld", s/3600, (s/60)%60, s%60);
+    return text;
+  }
+};
+
+double SweepStats::progress_interval = 10.;
+
+#endif // SWEEP_STATS_H
@@ -0,0 +1,171 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <exception>
+#include <cstddef>
+#include <iterator>
+
+// work stealing pool: every worker owns a deque of index ranges, takes work
+// from the back of its own deque and steals from the front of the others.
+class ThreadPool {
+public:
+  typedef std::function<void(size_t begin, size_t end, int worker)> RangeFunction;
+
+  ThreadPool(int num_threads) : queues(num_threads < 1 ? 1 : num_threads) {
+    for (int i = 0; i < queues.size(); i++)
+      workers.push_back(std::thread(&ThreadPool::worker_loop, this, i));
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(wake_mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (int i = 0; i < workers.size(); i++) workers.at(i).join();
+  }
+
+  int size() const { return queues.size(); }
+
+  static int hardware_threads() {
+    int n = std::thread::hardware_concurrency();
+    return (n < 1) ? 1 : n;
+  }
+
+  // calls body(begin, end, worker) over [0,n) in chunks of at most grain
+  // indices and blocks until every chunk is done. worker is in [0,size()).
+  // called from a task of this pool, the calling worker runs chunks of the
+  // new job while it waits, so nested calls finish even with every worker
+  // inside one; it takes no other work, so a suspended task's worker index
+  // is not reused under it.
+  void parallel_for(size_t n, size_t grain, const RangeFunction& body) {
+    if (n == 0) return;
+    if (grain < 1) grain = 1;
+    Job job;
+    job.body = &body;
+    job.remaining = (n + grain - 1) / grain;
+
+    size_t chunk = 0;
+    for (size_t begin = 0; begin < n; begin += grain, chunk++) {
+      size_t end = (begin + grain < n) ? begin + grain : n;
+      WorkQueue& q = queues.at(chunk % queues.size());
+      std::lock_guard<std::mutex> lock(q.mutex);
+      q.tasks.push_back(Task{begin, end, &job});
+    }
+    {
+      std::lock_guard<std::mutex> lock(wake_mutex);
+      pending_generation++;
+    }
+    wake.notify_all();
+
+    if (current_pool == this) {
+      Task task;
+      while (take(current_worker, task, &job)) run(task, current_worker);
+    }
+    std::unique_lock<std::mutex> lock(job.mutex);
+    job.done.wait(lock, [&job]{ return job.remaining == 0; });
+    if (job.error) std::rethrow_exception(job.error);
+  }
+
+private:
+  ThreadPool(ThreadPool const&) = delete;
+  void operator=(ThreadPool const&) = delete;
+
+  struct Job {
+    const RangeFunction* body;
+    size_t remaining;
+    std::exception_ptr error;
+    std::mutex mutex;
+    std::condition_variable done;
+  };
+
+  struct Task {
+    size_t begin, end;
+    Job* job;
+  };
+
+  struct WorkQueue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  static thread_local ThreadPool* current_pool; // of the worker thread running this
+  static thread_local int current_worker;
+
+  std::vector<WorkQueue> queues;
+  std::vector<std::thread> workers;
+  std::mutex wake_mutex;
+  std::condition_variable wake;
+  unsigned long pending_generation = 0;
+  bool stopping = false;
+
+  // a task from the back of the own deque or the front of another; with
+  // only set, the nearest task of that job
+  bool take(int worker, Task& task, const Job* only = NULL) {
+    WorkQueue& own = queues.at(worker);
+    {
+      std::lock_guard<std::mutex> lock(own.mutex);
+      if (only) {
+        for (std::deque<Task>::reverse_iterator it = own.tasks.rbegin(); it != own.tasks.rend(); it++)
+          if (it->job == only) { task = *it; own.tasks.erase(std::next(it).base()); return true; }
+      }
+      else if (!own.tasks.empty()) {
+        task = own.tasks.back(); own.tasks.pop_back();
+        return true;
+      }
+    }
+    for (int i = 1; i < queues.size(); i++) {
+      WorkQueue& victim = queues.at((worker + i) % queues.size());
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (only) {
+        for (std::deque<Task>::iterator it = victim.tasks.begin(); it != victim.tasks.end(); it++)
+          if (it->job == only) { task = *it; victim.tasks.erase(it); return true; }
+      }
+      else if (!victim.tasks.empty()) {
+        task = victim.tasks.front(); victim.tasks.pop_front();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void run(Task& task, int worker) {
+    Job* job = task.job;
+    try {
+      (*job->body)(task.begin, task.end, worker);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(job->mutex);
+      if (!job->error) job->error = std::current_exception();
+    }
+    std::lock_guard<std::mutex> lock(job->mutex);
+    if (--job->remaining == 0) job->done.notify_all();
+  }
+
+  void worker_loop(int worker) {
+    current_pool = this;
+    current_worker = worker;
+    unsigned long seen_generation = 0;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(wake_mutex);
+        wake.wait(lock, [&]{ return stopping || pending_generation != seen_generation; });
+        if (stopping) return;
+        seen_generation = pending_generation;
+      }
+      Task task;
+      while (take(worker, task)) run(task, worker);
+    }
+  }
+};
+
+thread_local ThreadPool* ThreadPool::current_pool = NULL;
+thread_local int ThreadPool::current_worker = 0;
+
+#endif // THREAD_POOL_H
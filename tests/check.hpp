@@ -0,0 +1,23 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <iostream>
+#include <string>
+
+// minimal known-answer checking: CHECK counts failures, main returns check_result()
+int check_failures = 0;
+
+#define CHECK(condition) check(condition, #condition, __FILE__, __LINE__)
+
+void check(bool passed, std::string what, std::string file, int line) {
+  if (passed) return;
+  std::cout << file << ":" << line << ": failed: " << what << std::endl;
+  check_failures++;
+}
+
+int check_result() {
+  if (check_failures > 0) std::cout << check_failures << " check(s) failed" << std::endl;
+  return check_failures == 0 ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ text and binary .data files read back bit for bit: awkward values (signed
+ zero, subnormals, extremes, decimals without an exact binary form) and
+ enough random rows to span several write blocks and parse chunks.
+*/
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#include "calculation.hpp"
+#include "check.hpp"
+
+const size_t num_columns = 3;
+
+std::vector<double> sample_rows() {
+  std::vector<double> values = { 0.1, 1./3., -0., 0., 4.9e-324, -2.2e-310, DBL_MIN, DBL_MAX, -DBL_MAX,
+    M_PI, 123456789012345678., -1e-300, 1e300, 2.5, -7. };
+  Philox philox(7);
+  for (size_t i = 0; i < 600000; i++) values.push_back((philox.uniform(i/2, 0, i%2) - 0.5)*std::pow(10., (double) (i%41) - 20.));
+  return values;
+}
+
+bool same_bits(const double* a, const double* b, size_t n) {
+  return std::memcmp(a, b, n*sizeof(double)) == 0;
+}
+
+// a sweep reloaded by a nowork run holds the rows it wrote
+Variable x("x",""), y("y","");
+RowResult awkward(const SweepPoint& p) { return {p[0].real(), p[1].real(), 1./(p[0].real()-p[1].real()), std::exp(-1e3*p[1].real())}; }
+
+bool reloads(bool binary) {
+  Calculation::binary_export = binary;
+  Calculation::nowork = false;
+  Calculation written(binary ? "reload_binary" : "reload_text");
+  written.headers = {"x", "y", "f", "g"};
+  written.work({&x,&y}, (SweepFunction) awkward);
+  Calculation::nowork = true;
+  Calculation reloaded(written.name);
+  reloaded.work({&x,&y}, (SweepFunction) awkward);
+  Calculation::nowork = false;
+  Calculation::binary_export = false;
+  if (data_file::is_binary(written.get_data_filepath()) != binary) return false;
+  if (reloaded.headers != written.headers || reloaded.data.size() != written.data.size()
+    || reloaded.data.width() != written.data.width()) return false;
+  for (size_t i = 0; i < written.data.size(); i++)
+    if (!same_bits(&reloaded.data[i][0], &written.data[i][0], written.data.width())) return false;
+  return true;
+}
+
+void write(DataSink& sink, const std::vector<double>& values) {
+  for (size_t i = 0; i < values.size(); i += num_columns) sink.write_row(&values[i], num_columns);
+  sink.close();
+}
+
+int main() {
+  calc_util::mkdir("test_output/");
+  std::vector<double> values = sample_rows();
+  std::vector<std::string> headers = {"a", "b", "c"};
+
+  std::string text_path = "test_output/round_trip.data";
+  TextDataSink text(text_path, headers);
+  write(text, values);
+  CHECK(!data_file::is_binary(text_path));
+  for (int threads : {1, 4}) {
+    TextDataReader reader(text_path);
+    std::vector<double> read;
+    reader.read(read, threads);
+    CHECK(reader.headers == headers);
+    CHECK(read.size() == values.size());
+    CHECK(read.size() == values.size() && same_bits(read.data(), values.data(), values.size()));
+  }
+
+  std::string binary_path = "test_output/round_trip.bin";
+  std::vector<size_t> shape = {values.size()/num_columns};
+  BinaryDataWriter binary(binary_path, headers, shape);
+  write(binary, values);
+  CHECK(data_file::is_binary(binary_path));
+  BinaryDataReader reader(binary_path);
+  CHECK(reader.good());
+  CHECK(reader.headers == headers);
+  CHECK(reader.shape == shape);
+  CHECK(reader.rows()*reader.columns() == values.size());
+  CHECK(reader.good() && reader.rows()*reader.columns() == values.size()
+    && same_bits(reader.records(), values.data(), values.size()));
+  ColumnView b = reader.column("b");
+  CHECK(b.size() == shape[0] && std::memcmp(&b[1], &values[num_columns+1], sizeof(double)) == 0);
+
+  SweepStats::progress_interval = 0;
+  Calculation::calc_path = "test_output/";
+  x.points = linspace(0.01, 3, 70);
+  y.points = logspace(1e-6, 1, 30);
+  CHECK(reloads(false));
+  CHECK(reloads(true));
+  return check_result();
+}
@@ -0,0 +1,22 @@
+/*
+ Philox4x32-10 against the known-answer vectors shipped with Random123
+ (kat_vectors, philox4x32_10), key and counter given as two 64 bit words.
+*/
+#include <cstdint>
+
+#include "philox.hpp"
+#include "check.hpp"
+
+bool matches(uint64_t key, uint64_t c0, uint64_t c1, uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+  Philox philox(key);
+  Philox::Block out = philox(c0, c1);
+  return out[0] == a && out[1] == b && out[2] == c && out[3] == d;
+}
+
+int main() {
+  CHECK(matches(0, 0, 0, 0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8));
+  CHECK(matches(~0ULL, ~0ULL, ~0ULL, 0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd));
+  CHECK(matches(0x299f31d0a4093822ULL, 0x85a308d3243f6a88ULL, 0x0370734413198a2eULL,
+    0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1));
+  return check_result();
+}
@@ -0,0 +1,52 @@
+/*
+ a sampled sweep gives the same rows, random() draws included, whatever the
+ number of threads and whether the iteration is serial, per point or batched.
+*/
+#include "calculation.hpp"
+#include "check.hpp"
+
+Variable x("x",""), y("y",""), z("z","");
+
+RowResult serial() { return {x.real(), y.real(), z.real(), calc_util::random()}; }
+RowResult per_point(const SweepPoint& p) { return {p[0].real(), p[1].real(), p[2].real(), calc_util::random()}; }
+void batched(const SweepBatch& b, BatchOutput& out) {
+  for (size_t i = 0; i < b.size; i++) {
+    for (int d = 0; d < 3; d++) out.columns[d][i] = b.re[d][i];
+    out.columns[3][i] = calc_util::random();
+  }
+}
+
+enum Kind { SERIAL, PER_POINT, BATCHED };
+
+std::vector<double> rows(Sampler::Method method, Kind kind, int threads, uint64_t seed) {
+  Calculation::threads = threads;
+  Calculation c("sampled");
+  c.headers = {"x", "y", "z", "r"};
+  if (kind == SERIAL) c.work_sampled({&x,&y,&z}, serial, method, 2000, seed);
+  if (kind == PER_POINT) c.work_sampled({&x,&y,&z}, (SweepFunction) per_point, method, 2000, seed);
+  if (kind == BATCHED) c.work_sampled({&x,&y,&z}, batched, method, 2000, seed);
+  Calculation::threads = 1;
+  std::vector<double> values;
+  for (size_t i = 0; i < c.data.size(); i++)
+    for (size_t j = 0; j < c.data.width(); j++) values.push_back(c.data[i][j]);
+  return values;
+}
+
+int main() {
+  SweepStats::progress_interval = 0;
+  Calculation::calc_path = "test_output/";
+  x.points = linspace(0, 1, 50);
+  y.points = linspace(-2, 2, 40);
+  z.points = logspace(1, 100, 30);
+  for (Sampler::Method method : {Sampler::MONTE_CARLO, Sampler::LATIN_HYPERCUBE, Sampler::SOBOL, Sampler::HALTON}) {
+    std::vector<double> reference = rows(method, SERIAL, 1, 3);
+    CHECK(reference.size() == 2000*4);
+    CHECK(rows(method, PER_POINT, 1, 3) == reference);
+    CHECK(rows(method, PER_POINT, 2, 3) == reference);
+    CHECK(rows(method, PER_POINT, 4, 3) == reference);
+    CHECK(rows(method, BATCHED, 1, 3) == rows(method, BATCHED, 4, 3));
+    CHECK(rows(method, BATCHED, 3, 3) == rows(method, BATCHED, 4, 3));
+  }
+  CHECK(rows(Sampler::MONTE_CARLO, PER_POINT, 4, 3) != rows(Sampler::MONTE_CARLO, PER_POINT, 4, 4));
+  return check_result();
+}
@@ -0,0 +1,80 @@
+/*
+ a grid computed as N shards and merged equals the same grid computed in one
+ run, file for file and row for row, for contiguous and strided shards in
+ text and binary, including shards that get no points.
+*/
+#include <fstream>
+#include <sstream>
+
+#include "calculation.hpp"
+#include "check.hpp"
+
+Variable x("x",""), y("y","");
+
+RowResult point(const SweepPoint& p) {
+  return {p[0].real(), p[1].real(), std::sin(p[0].real())*std::cosh(p[1].real()), calc_util::random()};
+}
+
+std::string contents(std::string path) {
+  std::ifstream in(path, std::ios::binary);
+  std::stringstream ss;
+  ss << in.rdbuf();
+  return ss.str();
+}
+
+bool same_rows(const Calculation& a, const Calculation& b) {
+  if (a.data.size() != b.data.size() || a.data.width() != b.data.width()) return false;
+  for (size_t i = 0; i < a.data.size(); i++)
+    for (size_t j = 0; j < a.data.width(); j++)
+      if (a.data[i][j] != b.data[i][j]) return false;
+  return true;
+}
+
+void sweep(Calculation& c) {
+  c.headers = {"x", "y", "f", "r"};
+  c.work({&x,&y}, (SweepFunction) point);
+}
+
+bool merged_equals_whole(size_t count, bool strided, bool binary, int threads) {
+  Calculation::binary_export = binary;
+  Calculation::threads = threads;
+  Calculation whole("whole");
+  sweep(whole);
+
+  for (size_t k = 0; k < count; k++) {
+    Calculation::shard.index = k;
+    Calculation::shard.count = count;
+    Calculation::shard.strided = strided;
+    Calculation part("parts");
+    sweep(part);
+  }
+  Calculation::shard = Shard();
+  Calculation::merge_shards = count;
+  Calculation merged("parts");
+  sweep(merged);
+  Calculation::merge_shards = 0;
+  Calculation::binary_export = false;
+  Calculation::threads = 1;
+
+  bool same_file = contents(merged.get_data_filepath()) == contents(whole.get_data_filepath());
+  return same_file && same_rows(merged, whole) && merged.data.size() == x.points.size()*y.points.size();
+}
+
+int main() {
+  SweepStats::progress_interval = 0;
+  Calculation::calc_path = "test_output/";
+  x.points = linspace(0, 2, 17);
+  y.points = linspace(-1, 1, 13);
+  for (bool binary : {false, true})
+    for (bool strided : {false, true}) {
+      CHECK(merged_equals_whole(1, strided, binary, 1));
+      CHECK(merged_equals_whole(3, strided, binary, 1));
+      CHECK(merged_equals_whole(4, strided, binary, 4));
+    }
+  // more shards than points: the empty parts still merge
+  x.points = linspace(0, 1, 2);
+  y.points = linspace(0, 1, 2);
+  CHECK(merged_equals_whole(6, false, false, 1));
+  CHECK(merged_equals_whole(6, true, true, 1));
+  return check_result();
+}